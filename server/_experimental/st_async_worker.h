@@ -64,10 +64,10 @@ using http_mq = blocking_queue<http_conn::ptr>;
 
 struct inference_output {
   tcp::socket sock;
-  std::vector<bbox> bboxes;
+  detection_result bboxes;
   inference_output() = delete;
   inference_output(inference_output& other) = delete;
-  inference_output(tcp::socket&& _sock, std::vector<bbox> _bboxes)
+  inference_output(tcp::socket&& _sock, detection_result _bboxes)
       : sock(std::move(_sock)), bboxes(std::move(_bboxes)){};
   using ptr = std::shared_ptr<inference_output>;
 };
@@ -416,7 +416,8 @@ class async_inference_worker {
         auto data = body.data();
         int size = body.size();
         // run the blob
-        auto detection_out = Ie->run_detection(data, size);
+        detection_result detection_out;
+        Ie->run_detection(data, size, detection_out);
         // push to resq
         resq->push(std::make_shared<inference_output>(
             std::move(sock), std::move(detection_out)));
@@ -447,30 +448,8 @@ class async_pp_worker {
         auto& sock = infer_out->sock;
         send_lambda<tcp::socket> sender{sock, close, ec};
         // create response and send throught the socket
-        int n = detection_out.size();
-        // create property tree and write to json
-        JSON detections;  // our response
-        JSON bboxes;      // predicion
-        for (int i = 0; i < n; ++i) {
-          // parse prediction[i] to p[i]
-          bbox& pred = detection_out[i];
-          JSON p;
-          p.put<int>("label_id", pred.label_id);
-          p.put<std::string>("label", pred.label);
-          p.put<float>("confidences", pred.prop);
-          JSON tmp;
-          for (int i = 0; i < 4; ++i) {
-            JSON v;
-            v.put<int>("", pred.c[i]);
-            tmp.push_back({"", v});
-          }
-          p.put_child("detection_box", tmp);
-          bboxes.push_back({"", p});
-        }
-        detections.put_child("predictions", bboxes);
-        std::ostringstream ss;
-        bpt::write_json(ss, detections);
-        auto body = ss.str();
+        std::string body;
+        write_json(detection_out, false, body);
         auto const size = body.size();
         beast_basic_response res{std::piecewise_construct,
                                  std::make_tuple(std::move(body)),
@@ -16,6 +16,7 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include "st_ie_nms.h"
 
 using namespace InferenceEngine;
 using namespace InferenceEngine::Extensions;
@@ -31,55 +32,6 @@ static bool sort_score_pair_descend(const std::pair<float, T> p0,
   return p0.first > p1.first;
 }
 
-struct ConfidenceComparator {
-  explicit ConfidenceComparator(const float* conf_data)
-      : _conf_data(conf_data) {}
-
-  bool operator()(int idx1, int idx2) {
-    if (_conf_data[idx1] > _conf_data[idx2]) return true;
-    if (_conf_data[idx1] < _conf_data[idx2]) return false;
-    return idx1 < idx2;
-  }
-
-  const float* _conf_data;
-};
-
-static inline float JaccardOverlap(const float* decoded_bbox,
-                                   const float* bbox_sizes, const int idx1,
-                                   const int idx2) {
-  float xmin1 = decoded_bbox[idx1 * 4 + 0];
-  float ymin1 = decoded_bbox[idx1 * 4 + 1];
-  float xmax1 = decoded_bbox[idx1 * 4 + 2];
-  float ymax1 = decoded_bbox[idx1 * 4 + 3];
-
-  float xmin2 = decoded_bbox[idx2 * 4 + 0];
-  float ymin2 = decoded_bbox[idx2 * 4 + 1];
-  float ymax2 = decoded_bbox[idx2 * 4 + 3];
-  float xmax2 = decoded_bbox[idx2 * 4 + 2];
-
-  if (xmin2 > xmax1 || xmax2 < xmin1 || ymin2 > ymax1 || ymax2 < ymin1) {
-    return 0.0f;
-  }
-
-  float intersect_xmin = std::max(xmin1, xmin2);
-  float intersect_ymin = std::max(ymin1, ymin2);
-  float intersect_xmax = std::min(xmax1, xmax2);
-  float intersect_ymax = std::min(ymax1, ymax2);
-
-  float intersect_width = intersect_xmax - intersect_xmin;
-  float intersect_height = intersect_ymax - intersect_ymin;
-
-  if (intersect_width <= 0 || intersect_height <= 0) {
-    return 0.0f;
-  }
-
-  float intersect_size = intersect_width * intersect_height;
-  float bbox1_size = bbox_sizes[idx1];
-  float bbox2_size = bbox_sizes[idx2];
-
-  return intersect_size / (bbox1_size + bbox2_size - intersect_size);
-}
-
 /**
  * @brief detection parsing layer for RCNN family
  *
@@ -120,7 +72,7 @@ class detection_output_inference {
   };
   void decodeBBoxes(const float* prior_data, const float* loc_data,
                     const float* variance_data, float* decoded_bboxes,
-                    float* decoded_bbox_sizes, int* num_priors_actual, int n) {
+                    int* num_priors_actual, int n) {
     num_priors_actual[n] = _num_priors;
     if (!_normalized) {
       int num = 0;
@@ -211,44 +163,27 @@ class detection_output_inference {
       decoded_bboxes[p * 4 + 1] = new_ymin;
       decoded_bboxes[p * 4 + 2] = new_xmax;
       decoded_bboxes[p * 4 + 3] = new_ymax;
-
-      decoded_bbox_sizes[p] = (new_xmax - new_xmin) * (new_ymax - new_ymin);
     }
   };
 
-  void nms(const float* conf_data, const float* bboxes, const float* sizes,
-           int* buffer, int* indices, int& detections, int num_priors_actual) {
-    int count = 0;
+  void nms(const float* conf_data, const float* bboxes, int* buffer,
+           int* indices, int& detections, int num_priors_actual) {
+    thread_local box_nms engine;
+    engine.clear();
     for (int i = 0; i < num_priors_actual; ++i) {
       if (conf_data[i] > _confidence_threshold) {
-        indices[count] = i;
-        count++;
+        // buffer maps the candidates back to the priors
+        buffer[engine.add(bboxes[i * 4 + 0], bboxes[i * 4 + 1],
+                          bboxes[i * 4 + 2], bboxes[i * 4 + 3], conf_data[i],
+                          0)] = i;
       }
     }
-
-    int num_output_scores =
-        (_top_k == -1 ? count : std::min<int>(_top_k, count));
-
-    std::partial_sort_copy(indices, indices + count, buffer,
-                           buffer + num_output_scores,
-                           ConfidenceComparator(conf_data));
-
-    for (int i = 0; i < num_output_scores; ++i) {
-      const int idx = buffer[i];
-
-      bool keep = true;
-      for (int k = 0; k < detections; ++k) {
-        const int kept_idx = indices[k];
-        float overlap = JaccardOverlap(bboxes, sizes, idx, kept_idx);
-        if (overlap > _nms_threshold) {
-          keep = false;
-          break;
-        }
-      }
-      if (keep) {
-        indices[detections] = idx;
-        detections++;
-      }
+    nms_params params;
+    params.iou_threshold = _nms_threshold;
+    params.top_k = _top_k;
+    for (int k : engine.run(params)) {
+      indices[detections] = buffer[k];
+      detections++;
     }
   };
 
@@ -257,7 +192,6 @@ class detection_output_inference {
   Blob::Ptr _indices;
   Blob::Ptr _detections_count;
   Blob::Ptr _reordered_conf;
-  Blob::Ptr _bbox_sizes;
   Blob::Ptr _num_priors_actual;
 
  public:
@@ -365,14 +299,6 @@ class detection_output_inference {
           make_shared_blob<float>({Precision::FP32, conf_size1, ANY});
       _reordered_conf->allocate();
 
-      SizeVector decoded_bboxes_size{static_cast<size_t>(_num * _num_classes),
-                                     static_cast<size_t>(_num_classes),
-                                     static_cast<size_t>(_num_priors)};
-      _bbox_sizes = make_shared_blob<int>({Precision::I32,
-                                           decoded_bboxes_size,
-                                           {decoded_bboxes_size, {0, 1, 2}}});
-      _bbox_sizes->allocate();
-
       SizeVector num_priors_actual_size{static_cast<size_t>(_num)};
       _num_priors_actual =
           make_shared_blob<int>({Precision::I32, num_priors_actual_size, C});
@@ -399,7 +325,6 @@ class detection_output_inference {
 
     float* decoded_bboxes_data = _decoded_bboxes->buffer();
     float* reordered_conf_data = _reordered_conf->buffer();
-    float* bbox_sizes_data = _bbox_sizes->buffer();
     int* detections_data = _detections_count->buffer();
     int* buffer_data = _buffer->buffer();
     int* indices_data = _indices->buffer();
@@ -412,9 +337,8 @@ class detection_output_inference {
       if (_share_location) {
         const float* ploc = loc_data + n * 4 * _num_priors;
         float* pboxes = decoded_bboxes_data + n * 4 * _num_priors;
-        float* psizes = bbox_sizes_data + n * _num_priors;
-        decodeBBoxes(ppriors, ploc, prior_variances, pboxes, psizes,
-                     num_priors_actual, n);
+        decodeBBoxes(ppriors, ploc, prior_variances, pboxes, num_priors_actual,
+                     n);
       } else {
         for (int c = 0; c < _num_loc_classes; ++c) {
           if (c == _background_label_id) {
@@ -426,8 +350,7 @@ class detection_output_inference {
           float* pboxes = decoded_bboxes_data +
                           n * 4 * _num_loc_classes * _num_priors +
                           c * 4 * _num_priors;
-          float* psizes = bbox_sizes_data + n * _num_priors;
-          decodeBBoxes(ppriors, ploc, prior_variances, pboxes, psizes,
+          decodeBBoxes(ppriors, ploc, prior_variances, pboxes,
                        num_priors_actual, n);
         }
       }
@@ -460,18 +383,14 @@ class detection_output_inference {
         const float* pconf =
             reordered_conf_data + n * _num_classes + c * _num_priors;
         const float* pboxes;
-        const float* psizes;
         if (_share_location) {
           pboxes = decoded_bboxes_data + n * 4 * _num_priors;
-          psizes = bbox_sizes_data + n * _num_priors;
         } else {
           pboxes = decoded_bboxes_data + n * 4 * _num_classes * _num_priors +
                    c * 4 * _num_priors;
-          psizes = bbox_sizes_data + n * _num_classes * _num_priors +
-                   c * _num_priors;
         }
 
-        nms(pconf, pboxes, psizes, pbuffer, pindices, *pdetections,
+        nms(pconf, pboxes, pbuffer, pindices, *pdetections,
             num_priors_actual[n]);
       }
 
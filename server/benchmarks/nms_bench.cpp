@@ -0,0 +1,226 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file benchmark the non-maximum suppression against the
+ * pairwise loop it replaces in the YOLO parser
+ ***************************************************************************************/
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "st_ie_nms.h"
+
+/// @brief messages of the arguments
+constexpr char help_message[] = "Print this message.";
+constexpr char candidates_message[] = "Number of candidate boxes";
+constexpr char classes_message[] = "Number of classes";
+constexpr char image_message[] = "Width and height of the image in pixels";
+constexpr char iterations_message[] = "Number of timed runs of each method";
+constexpr char grid_message[] = "Cells per side of the spatial grid";
+
+DEFINE_bool(h, false, help_message);
+DEFINE_int32(n, 5000, candidates_message);
+DEFINE_int32(c, 15, classes_message);
+DEFINE_int32(s, 4000, image_message);
+DEFINE_int32(i, 20, iterations_message);
+DEFINE_int32(g, 16, grid_message);
+
+using namespace st::ie;
+
+/**
+ * @brief Candidate box, as produced by the YOLO parser
+ *
+ */
+struct candidate {
+  int xmin, ymin, xmax, ymax, class_id;
+  float confidence;
+  bool operator>(const candidate& other) const {
+    return confidence > other.confidence;
+  }
+};
+
+/**
+ * @brief Dense aerial scene: clusters of small objects, each object found
+ * several times with some jitter
+ *
+ * @return std::vector<candidate>
+ */
+std::vector<candidate> make_scene(int n, int classes, int size) {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> pos(0.f, static_cast<float>(size));
+  std::uniform_real_distribution<float> dim(8.f, 64.f);
+  std::uniform_real_distribution<float> score(0.5f, 1.f);
+  std::normal_distribution<float> jitter(0.f, 3.f);
+  std::uniform_int_distribution<int> cls(0, classes - 1);
+  std::uniform_int_distribution<int> dups(1, 6);
+  std::vector<candidate> ret;
+  while (static_cast<int>(ret.size()) < n) {
+    const float x = pos(rng), y = pos(rng), w = dim(rng), h = dim(rng);
+    const int c = cls(rng);
+    for (int k = dups(rng); k > 0 && static_cast<int>(ret.size()) < n; --k) {
+      candidate o;
+      o.xmin = static_cast<int>(x + jitter(rng));
+      o.ymin = static_cast<int>(y + jitter(rng));
+      o.xmax = static_cast<int>(x + w + jitter(rng));
+      o.ymax = static_cast<int>(y + h + jitter(rng));
+      o.class_id = c;
+      o.confidence = score(rng);
+      ret.push_back(o);
+    }
+  }
+  return ret;
+}
+
+/**
+ * @brief The loop of the YOLO parser before box_nms
+ *
+ */
+double legacy_iou(const candidate& box_1, const candidate& box_2) {
+  double width_of_overlap_area =
+      fmin(box_1.xmax, box_2.xmax) - fmax(box_1.xmin, box_2.xmin);
+  double height_of_overlap_area =
+      fmin(box_1.ymax, box_2.ymax) - fmax(box_1.ymin, box_2.ymin);
+  double area_of_overlap;
+  if (width_of_overlap_area < 0 || height_of_overlap_area < 0)
+    area_of_overlap = 0;
+  else
+    area_of_overlap = width_of_overlap_area * height_of_overlap_area;
+  double box_1_area = (box_1.ymax - box_1.ymin) * (box_1.xmax - box_1.xmin);
+  double box_2_area = (box_2.ymax - box_2.ymin) * (box_2.xmax - box_2.xmin);
+  double area_of_union = box_1_area + box_2_area - area_of_overlap;
+  return area_of_overlap / area_of_union;
+}
+size_t legacy_nms(std::vector<candidate> objects, float threshold) {
+  std::sort(objects.begin(), objects.end(), std::greater<candidate>());
+  for (size_t i = 0; i < objects.size(); ++i) {
+    if (objects[i].confidence == 0) continue;
+    for (size_t j = i + 1; j < objects.size(); ++j)
+      if (legacy_iou(objects[i], objects[j]) >= threshold)
+        objects[j].confidence = 0;
+  }
+  size_t kept = 0;
+  for (auto& o : objects) kept += o.confidence > 0;
+  return kept;
+}
+
+/**
+ * @brief Plain per-class greedy suppression, the reference of box_nms
+ *
+ */
+std::vector<int> reference_nms(const std::vector<candidate>& objects,
+                               float threshold) {
+  std::vector<int> order(objects.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    if (objects[a].class_id != objects[b].class_id)
+      return objects[a].class_id < objects[b].class_id;
+    if (objects[a].confidence != objects[b].confidence)
+      return objects[a].confidence > objects[b].confidence;
+    return a < b;
+  });
+  std::vector<int> kept;
+  for (size_t k = 0; k < order.size(); ++k) {
+    const candidate& b = objects[order[k]];
+    const float b_area = static_cast<float>(b.xmax - b.xmin) *
+                         static_cast<float>(b.ymax - b.ymin);
+    bool keep = true;
+    for (int i : kept) {
+      const candidate& a = objects[i];
+      if (a.class_id != b.class_id) continue;
+      const float w = static_cast<float>(std::min(a.xmax, b.xmax) -
+                                         std::max(a.xmin, b.xmin));
+      const float h = static_cast<float>(std::min(a.ymax, b.ymax) -
+                                         std::max(a.ymin, b.ymin));
+      const float inter = std::max(w, 0.f) * std::max(h, 0.f);
+      const float a_area = static_cast<float>(a.xmax - a.xmin) *
+                           static_cast<float>(a.ymax - a.ymin);
+      const float uni = std::max(a_area + b_area - inter, FLT_MIN);
+      if (inter > threshold * uni) {
+        keep = false;
+        break;
+      }
+    }
+    if (keep) kept.push_back(order[k]);
+  }
+  return kept;
+}
+
+/**
+ * @brief Average time of a function in milliseconds
+ *
+ */
+double time_ms(const std::function<size_t()>& fn, int iterations,
+               size_t* result) {
+  *result = fn();  // warm up
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) *result = fn();
+  const std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineNonHelpFlags(&argc, &argv, true);
+  if (FLAGS_h) {
+    std::cout << "nms_bench [-n candidates] [-c classes] [-s image size] "
+                 "[-i iterations] [-g grid size]"
+              << std::endl;
+    return 0;
+  }
+  const float threshold = 0.4f;
+  const auto objects = make_scene(FLAGS_n, FLAGS_c, FLAGS_s);
+  box_nms nms;
+  auto run_box_nms = [&](const nms_params& params) -> size_t {
+    nms.clear();
+    for (auto& o : objects) {
+      nms.add(o.xmin, o.ymin, o.xmax, o.ymax, o.confidence, o.class_id);
+    }
+    return nms.run(params).size();
+  };
+  nms_params hard;
+  hard.iou_threshold = threshold;
+  nms_params grid = hard;
+  grid.grid_size = FLAGS_g;
+  nms_params soft = hard;
+  soft.soft = true;
+  soft.score_threshold = 0.5f;
+
+  // box_nms must keep the same boxes as the plain per-class loop
+  auto expected = reference_nms(objects, threshold);
+  for (const nms_params* params : {&hard, &grid}) {
+    run_box_nms(*params);
+    std::vector<int> kept = nms.run(*params);
+    if (kept != expected) {
+      std::cerr << "box_nms differs from the reference, grid size "
+                << params->grid_size << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << objects.size() << " candidates, " << FLAGS_c << " classes, "
+            << "kernels: " << st::simd::isa_name(st::simd::best_isa())
+            << std::endl;
+  size_t kept = 0;
+  double ms = time_ms([&]() { return legacy_nms(objects, threshold); },
+                      FLAGS_i, &kept);
+  std::cout << "legacy (all classes, double) " << ms << " ms, " << kept
+            << " kept" << std::endl;
+  ms = time_ms([&]() { return reference_nms(objects, threshold).size(); },
+               FLAGS_i, &kept);
+  std::cout << "reference (per class, scalar) " << ms << " ms, " << kept
+            << " kept" << std::endl;
+  ms = time_ms([&]() { return run_box_nms(hard); }, FLAGS_i, &kept);
+  std::cout << "box_nms " << ms << " ms, " << kept << " kept" << std::endl;
+  ms = time_ms([&]() { return run_box_nms(grid); }, FLAGS_i, &kept);
+  std::cout << "box_nms grid " << FLAGS_g << " " << ms << " ms, " << kept
+            << " kept" << std::endl;
+  ms = time_ms([&]() { return run_box_nms(soft); }, FLAGS_i, &kept);
+  std::cout << "box_nms soft " << ms << " ms, " << kept << " kept"
+            << std::endl;
+  return 0;
+}
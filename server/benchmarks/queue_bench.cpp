@@ -0,0 +1,137 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file benchmark the lock-free task queue against the mutex
+ * based queue it replaces, with many producers and consumers
+ ***************************************************************************************/
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "st_message_queue.h"
+#include "st_mpmc_queue.h"
+
+/// @brief messages of the arguments
+constexpr char help_message[] = "Print this message.";
+constexpr char producers_message[] = "Number of producer threads";
+constexpr char consumers_message[] = "Number of consumer threads";
+constexpr char messages_message[] = "Number of messages per producer";
+constexpr char capacity_message[] =
+    "Capacity of the lock-free queue, 0 to hold all the messages like the "
+    "unbounded blocking_queue";
+constexpr char iterations_message[] = "Number of timed runs of each queue";
+
+DEFINE_bool(h, false, help_message);
+DEFINE_int32(p, 16, producers_message);
+DEFINE_int32(c, 4, consumers_message);
+DEFINE_int32(n, 100000, messages_message);
+DEFINE_int32(q, 0, capacity_message);
+DEFINE_int32(i, 5, iterations_message);
+
+/**
+ * @brief Stand-in of the task message: a few words and a shared pointer,
+ * so moving it costs what moving a task costs
+ *
+ */
+struct task {
+  const char* data = nullptr;
+  int size = 0;
+  std::uint64_t value = 0;
+  std::shared_ptr<int> bell;
+};
+
+/**
+ * @brief Run the producers and the consumers on one queue
+ * @details Each producer pushes n messages, the consumers stop on a message
+ * with a null bell. The sum of the values checks that every message was
+ * delivered exactly once.
+ * @return double throughput in million messages per second
+ */
+template <class Queue>
+double run(Queue& queue, int producers, int consumers, int n, bool* ok) {
+  std::atomic<std::uint64_t> sum{0};
+  std::vector<std::thread> threads;
+  const auto bell = std::make_shared<int>(0);
+  const auto start = std::chrono::steady_clock::now();
+  for (int c = 0; c < consumers; ++c) {
+    threads.emplace_back([&queue, &sum]() {
+      std::uint64_t local = 0;
+      for (;;) {
+        task t = queue.pop();
+        if (!t.bell) break;
+        local += t.value;
+      }
+      sum += local;
+    });
+  }
+  std::vector<std::thread> writers;
+  for (int p = 0; p < producers; ++p) {
+    writers.emplace_back([&queue, &bell, n]() {
+      for (int k = 1; k <= n; ++k) {
+        task t;
+        t.value = k;
+        t.bell = bell;
+        queue.push(std::move(t));
+      }
+    });
+  }
+  for (auto& w : writers) w.join();
+  for (int c = 0; c < consumers; ++c) queue.push(task());
+  for (auto& t : threads) t.join();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const std::uint64_t expected =
+      static_cast<std::uint64_t>(producers) * n * (n + 1ULL) / 2;
+  *ok = sum == expected;
+  return static_cast<double>(producers) * n / elapsed.count() / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineNonHelpFlags(&argc, &argv, true);
+  if (FLAGS_h) {
+    std::cout << "queue_bench [-p producers] [-c consumers] "
+                 "[-n messages per producer] [-q capacity] [-i iterations]"
+              << std::endl;
+    return 0;
+  }
+  using blocking = st::sync::blocking_queue<task>;
+  using lock_free = st::sync::mpmc_queue<task>;
+  // a full ring parks the producers, which blocking_queue never does, so by
+  // default the ring is large enough for all the messages
+  const size_t capacity =
+      FLAGS_q > 0 ? FLAGS_q
+                  : static_cast<size_t>(FLAGS_p) * FLAGS_n + FLAGS_c;
+  // the runs of both queues are interleaved, a queue run after the other one
+  // is not favored, and the best run of each queue is kept
+  double blocking_rate = 0, lock_free_rate = 0;
+  bool blocking_ok = true, lock_free_ok = true;
+  for (int i = 0; i < FLAGS_i; ++i) {
+    bool ok = false;
+    blocking blocking_queue;
+    blocking_rate = std::max(
+        blocking_rate, run(blocking_queue, FLAGS_p, FLAGS_c, FLAGS_n, &ok));
+    blocking_ok = blocking_ok && ok;
+    lock_free lock_free_queue(capacity);
+    lock_free_rate = std::max(
+        lock_free_rate, run(lock_free_queue, FLAGS_p, FLAGS_c, FLAGS_n, &ok));
+    lock_free_ok = lock_free_ok && ok;
+  }
+  if (!blocking_ok || !lock_free_ok) {
+    std::cerr << "messages were lost or duplicated" << std::endl;
+    return 1;
+  }
+  std::cout << FLAGS_p << " producers, " << FLAGS_c << " consumers, "
+            << FLAGS_n << " messages per producer, ring of "
+            << capacity << std::endl;
+  std::cout << "blocking_queue: " << blocking_rate << " M messages/s"
+            << std::endl;
+  std::cout << "mpmc_queue:     " << lock_free_rate << " M messages/s"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,159 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file benchmark the scheduling policies of the dispatcher
+ * with mock engines of different latencies, no accelerator needed
+ ***************************************************************************************/
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "st_dispatcher.h"
+#include "st_ie_mock.h"
+
+/// @brief messages of the arguments
+constexpr char help_message[] = "Print this message.";
+constexpr char latencies_message[] =
+    "Comma-separated latencies of the mock engines in microseconds";
+constexpr char rate_message[] = "Arrival rate in requests per second";
+constexpr char requests_message[] = "Number of requests of each run";
+constexpr char size_message[] = "Size of the images in bytes";
+
+DEFINE_bool(h, false, help_message);
+DEFINE_string(l, "2000,2000,2000,10000", latencies_message);
+DEFINE_int32(r, 1000, rate_message);
+DEFINE_int32(n, 5000, requests_message);
+DEFINE_int32(s, 100000, size_message);
+
+using namespace st::sync;
+using namespace st::ie;
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * @brief Stand-in of the task message
+ *
+ */
+struct task {
+  const char* data = nullptr;
+  int size = 0;  //!< -1 stops the worker
+  int id = 0;
+  clock_type::time_point arrival;
+  clock_type::time_point deadline = clock_type::time_point::max();
+};
+
+/**
+ * @brief Latencies and per-engine counts of one run
+ *
+ */
+struct run_result {
+  std::vector<double> latency_ms;
+  std::vector<int> served;
+};
+
+/**
+ * @brief Open-loop run: the requests arrive at the given rate whatever the
+ * latency, like independent clients
+ *
+ */
+run_result run(const std::vector<int>& latencies, schedule_policy policy) {
+  const size_t n = latencies.size();
+  std::vector<replica_info> infos(n, replica_info{"mock"});
+  dispatcher<task> queue(infos, 1024, policy);
+  std::vector<char> image(FLAGS_s);
+  run_result result;
+  result.latency_ms.assign(FLAGS_n, 0);
+  std::vector<std::atomic<int>> served(n);
+  for (auto& s : served) s = 0;
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < n; ++i) {
+    workers.emplace_back([&, i]() {
+      mock_inference_engine engine(latencies[i], 0);
+      detection_result prediction;
+      for (;;) {
+        task t = queue.pop(i);
+        if (t.size < 0) return;
+        const auto start = clock_type::now();
+        engine.run_detection(t.data, t.size, prediction, inference_params());
+        const auto end = clock_type::now();
+        queue.done(i, t.size, end - start);
+        const std::chrono::duration<double, std::milli> latency =
+            end - t.arrival;
+        result.latency_ms[t.id] = latency.count();
+        ++served[i];
+      }
+    });
+  }
+  std::mt19937 rng(42);
+  std::exponential_distribution<double> gap(FLAGS_r);
+  auto next = clock_type::now();
+  for (int k = 0; k < FLAGS_n; ++k) {
+    next += std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(gap(rng)));
+    std::this_thread::sleep_until(next);
+    task t;
+    t.data = image.data();
+    t.size = FLAGS_s;
+    t.id = k;
+    t.arrival = clock_type::now();
+    queue.push(std::move(t));
+  }
+  // one stop task pinned to each engine, after all the requests
+  for (size_t i = 0; i < n; ++i) {
+    task stop;
+    stop.size = -1;
+    queue.push_to(std::move(stop), std::uint64_t(1) << i);
+  }
+  for (auto& w : workers) w.join();
+  for (auto& s : served) result.served.push_back(s);
+  return result;
+}
+
+double percentile(std::vector<double> v, double p) {
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, static_cast<size_t>(p * v.size()))];
+}
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineNonHelpFlags(&argc, &argv, true);
+  if (FLAGS_h) {
+    std::cout << "scheduler_bench [-l latencies] [-r rate] [-n requests] "
+                 "[-s image size]"
+              << std::endl;
+    return 0;
+  }
+  std::vector<int> latencies;
+  std::stringstream ss(FLAGS_l);
+  std::string item;
+  while (std::getline(ss, item, ',')) latencies.push_back(std::stoi(item));
+  if (latencies.empty()) {
+    std::cerr << "no engine" << std::endl;
+    return 1;
+  }
+  std::cout << latencies.size() << " mock engines, " << FLAGS_r
+            << " requests/s, " << FLAGS_n << " requests" << std::endl;
+  const std::pair<const char*, schedule_policy> policies[] = {
+      {"two choices", schedule_policy::TWO_CHOICES},
+      {"earliest finish", schedule_policy::EARLIEST_FINISH}};
+  for (const auto& policy : policies) {
+    const run_result r = run(latencies, policy.second);
+    const double mean =
+        std::accumulate(r.latency_ms.begin(), r.latency_ms.end(), 0.0) /
+        r.latency_ms.size();
+    std::cout << policy.first << ": mean " << mean << " ms, p50 "
+              << percentile(r.latency_ms, 0.5)
+              << " ms, p99 " << percentile(r.latency_ms, 0.99)
+              << " ms, served";
+    for (int s : r.served) std::cout << ' ' << s;
+    std::cout << std::endl;
+  }
+  return 0;
+}
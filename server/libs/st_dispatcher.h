@@ -0,0 +1,773 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the dispatching of the tasks to the inference
+ * replicas, one earliest-deadline-first queue per replica with work stealing
+ ***************************************************************************************/
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "st_mpmc_queue.h"
+
+namespace st {
+namespace sync {
+
+/**
+ * @brief How the dispatcher picks the replica of a task
+ *
+ */
+enum class schedule_policy {
+  TWO_CHOICES,     //!< shorter queue of two random replicas
+  EARLIEST_FINISH  //!< lowest predicted completion time
+};
+
+// convert string to scheduling policy
+inline schedule_policy str2policy(const std::string& policy_name) {
+  std::string policy;
+  std::transform(policy_name.begin(), policy_name.end(),
+                 std::back_inserter(policy),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (policy == "two choices") {
+    return schedule_policy::TWO_CHOICES;
+  } else if (policy == "earliest finish") {
+    return schedule_policy::EARLIEST_FINISH;
+  } else {
+    throw std::logic_error("Scheduler [" + policy_name +
+                           "] has not yet implemented");
+  }
+}
+
+/**
+ * @brief What the dispatcher knows about a replica
+ *
+ */
+struct replica_info {
+  std::string device;  //!< device of the engine, e.g. "intel cpu"
+};
+
+/**
+ * @brief Limits of the work waiting in the dispatcher, new requests beyond
+ * them are turned away
+ *
+ */
+struct admission_limits {
+  int max_queued = 0;  //!< tasks in the queues, 0 for the queue capacity
+  std::chrono::milliseconds max_delay{0};  //!< predicted wait, 0 for none
+};
+
+/**
+ * @brief Moving average of the service time of a replica, by input size
+ * @details Exponentially weighted, the last sample weighs 1/8. The inputs
+ * are bucketed by the power of two of their size in bytes, a bucket without
+ * sample falls back to the average of all the inputs. Concurrent updates may
+ * lose a sample, which only slows down the convergence.
+ */
+class service_time {
+ public:
+  static constexpr int buckets = 32;
+  service_time() {
+    for (auto& t : by_size) t.store(0, std::memory_order_relaxed);
+  }
+  /**
+   * @brief Add a sample
+   *
+   * @param size of the input in bytes
+   * @param ns service time in nanoseconds
+   */
+  void record(int size, std::int64_t ns) {
+    update(overall, ns);
+    update(by_size[bucket(size)], ns);
+  }
+  /**
+   * @brief Predicted service time of an input
+   *
+   * @param size of the input in bytes
+   * @return std::int64_t nanoseconds, 0 before the first sample
+   */
+  std::int64_t predict(int size) const {
+    const std::int64_t t =
+        by_size[bucket(size)].load(std::memory_order_relaxed);
+    return t != 0 ? t : average();
+  }
+  /**
+   * @brief Average service time of all the inputs
+   *
+   * @return std::int64_t nanoseconds, 0 before the first sample
+   */
+  std::int64_t average() const {
+    return overall.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<std::int64_t> overall{0};
+  std::atomic<std::int64_t> by_size[buckets];
+
+  static int bucket(int size) {
+    int b = 0;
+    for (unsigned s = size > 0 ? size : 1; s > 1; s >>= 1) ++b;
+    return std::min(b, buckets - 1);
+  }
+  static void update(std::atomic<std::int64_t>& avg, std::int64_t ns) {
+    // 0 means no sample yet, keep the average positive
+    const std::int64_t old = avg.load(std::memory_order_relaxed);
+    const std::int64_t next = old == 0 ? ns : old + (ns - old) / 8;
+    avg.store(std::max<std::int64_t>(next, 1), std::memory_order_relaxed);
+  }
+};
+
+/**
+ * @brief Queue that hands out the item with the earliest deadline first
+ * @details Producers push to a bounded lock-free ring. Consumers move the
+ * items of the ring to a heap ordered by deadline, under a mutex that only
+ * the consumers take, then pop the top of the heap. Items with the same
+ * deadline, e.g. without one, keep their push order. The heap holds at most
+ * capacity items, the others stay in the ring and push waits while the ring
+ * is full. The order is therefore earliest deadline first only among the
+ * items in the heap: an item that waits in the ring behind capacity older
+ * ones is not seen before the heap has room for it, whatever its deadline.
+ * @tparam Message Message type, with its steady_clock deadline in deadline
+ */
+template <class Message>
+class deadline_queue {
+ public:
+  /**
+   * @brief Construct a new deadline queue object
+   *
+   * @param capacity of the ring and of the heap
+   */
+  explicit deadline_queue(size_t capacity = 1024)
+      : ring(capacity), limit(ring.capacity()) {
+    heap.reserve(limit);
+  }
+  /**
+   * @brief Push an item if the ring is not full, never blocks
+   *
+   * @param item moved from only on success
+   * @return true on success
+   */
+  bool try_push(Message&& item) {
+    // the consumers sleep on the event count of the dispatcher, never on the
+    // ring, nobody needs to be woken
+    return ring.try_push_quiet(std::move(item));
+  }
+  /**
+   * @brief Push an item, wait while the ring is full
+   *
+   * @param item
+   */
+  void push(Message&& item) { ring.push(std::move(item)); }
+  /**
+   * @brief Pop the item with the earliest deadline, never blocks
+   *
+   * @param item
+   * @return false if the queue is empty
+   */
+  bool try_pop(Message& item) {
+    if (held.load(std::memory_order_relaxed) == 0 && ring.size() == 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    Message incoming;
+    bool moved = false;
+    while (heap.size() < limit) {
+      // counted before it leaves the ring, so that size() doesn't miss an
+      // item on its way to the heap, at worst it counts one too many
+      held.store(static_cast<int>(heap.size()) + 1, std::memory_order_release);
+      if (!ring.try_pop_quiet(incoming)) break;
+      moved = true;
+      const auto deadline = incoming.deadline;
+      heap.push_back(entry{deadline, order++, std::move(incoming)});
+      std::push_heap(heap.begin(), heap.end(), later);
+    }
+    // one wake up for the whole drain, for the producers blocked in push
+    if (moved) ring.wake_producers();
+    if (heap.empty()) {
+      held.store(0, std::memory_order_relaxed);
+      return false;
+    }
+    std::pop_heap(heap.begin(), heap.end(), later);
+    item = std::move(heap.back().item);
+    heap.pop_back();
+    held.store(static_cast<int>(heap.size()), std::memory_order_relaxed);
+    return true;
+  }
+  /**
+   * @brief Get current number of items, a snapshot
+   *
+   * @return int
+   */
+  int size() const {
+    return ring.size() + held.load(std::memory_order_acquire);
+  }
+  /**
+   * @brief Capacity of the ring, rounded up to a power of two
+   *
+   * @return size_t
+   */
+  size_t capacity() const { return limit; }
+
+ private:
+  struct entry {
+    std::chrono::steady_clock::time_point deadline;
+    std::uint64_t order;  //!< push order, breaks the ties
+    Message item;
+  };
+  mpmc_queue<Message> ring;
+  const size_t limit;
+  std::mutex mtx;            //!< guards the heap and order
+  std::vector<entry> heap;   //!< the latest deadline at the bottom
+  std::uint64_t order = 0;
+  std::atomic<int> held{0};  //!< size of the heap, read without the mutex
+
+  static bool later(const entry& a, const entry& b) {
+    return a.deadline != b.deadline ? a.deadline > b.deadline
+                                    : a.order > b.order;
+  }
+};
+
+/**
+ * @brief Work-stealing dispatcher of the tasks to the inference replicas
+ * @details Every replica has its own queue, which hands out the task with the
+ * earliest deadline first. With EARLIEST_FINISH, a task goes
+ * to the replica with the lowest predicted completion time: the tasks it
+ * holds times its average service time, plus its service time for inputs of
+ * the size of the task. The inference workers report the service time of
+ * every task with done. A replica without sample is predicted as fast as the
+ * fastest one, so that it gets tried. With TWO_CHOICES, a task goes to the
+ * shorter of the queues of two replicas picked at random.
+ *
+ * A replica pops from its own queue first and steals from the queues of the
+ * other replicas when its own queue is empty, so a fast replica helps a slow
+ * one. With EARLIEST_FINISH, a replica doesn't steal a task that its owner
+ * would finish before it. A task pushed with push_to is pinned to a set of
+ * replicas, e.g. the ones of a device, and is never stolen by another one.
+ *
+ * Like the server, the dispatcher assumes that all the replicas serve the
+ * same model, possibly compiled for each device: any replica may run any
+ * task that isn't pinned.
+ *
+ * Producers use the interface of blocking_queue, plus try_push and
+ * try_push_to that never block, for the threads that must not wait for a
+ * consumer. Consumers pass their replica index to pop and pop_batch.
+ * @tparam Message Message type, with the size of its input in size and its
+ * steady_clock deadline in deadline
+ */
+template <class Message>
+class dispatcher {
+ public:
+  static constexpr size_t max_replicas = 64;  //!< bits of the masks
+  /**
+   * @brief Construct a new dispatcher object
+   *
+   * @param infos device of each replica
+   * @param capacity capacity of the queues of each replica
+   * @param _policy
+   */
+  dispatcher(const std::vector<replica_info>& infos, size_t capacity = 1024,
+             schedule_policy _policy = schedule_policy::EARLIEST_FINISH)
+      : policy(_policy) {
+    if (infos.empty() || infos.size() > max_replicas) {
+      throw std::logic_error("Dispatcher: expected 1 to 64 replicas, got " +
+                             std::to_string(infos.size()));
+    }
+    replicas.reserve(infos.size());
+    for (size_t i = 0; i < infos.size(); ++i) {
+      replicas.emplace_back(new replica(capacity, infos[i].device));
+      all |= std::uint64_t(1) << i;
+    }
+    for (size_t i = 0; i < infos.size(); ++i) {
+      replicas[i]->mask = all & ~(std::uint64_t(1) << i);
+    }
+  }
+  dispatcher(const dispatcher&) = delete;
+  dispatcher& operator=(const dispatcher&) = delete;
+  /**
+   * @brief Push an item to the replica picked by the policy, wait while the
+   * queues are full
+   *
+   * @param item
+   */
+  void push(const Message& item) {
+    Message copy(item);
+    push(std::move(copy));
+  }
+  void push(Message&& item) { dispatch(std::move(item), all, false); }
+  /**
+   * @brief Push a range of items, each one is dispatched on its own
+   *
+   * @tparam Iterator
+   * @param first
+   * @param last
+   */
+  template <class Iterator>
+  void push(Iterator first, Iterator last) {
+    for (; first != last; ++first) push(*first);
+  }
+  /**
+   * @brief Push an item to the replica picked by the policy, or to any other
+   * replica if its queue is full, never blocks
+   *
+   * @param item moved from only on success
+   * @return false if the queues of all the replicas are full
+   */
+  bool try_push(Message&& item) {
+    if (!reserve(1)) return false;
+    if (try_dispatch(item, choose(item.size, all), all, false)) return true;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  /**
+   * @brief Push a range of items without blocking, each one is dispatched on
+   * its own, up to the first one that doesn't fit
+   * @details The range is admitted as a whole against max_queued: either
+   * all the items are counted or none is pushed.
+   *
+   * @tparam Iterator
+   * @param first
+   * @param last
+   * @return Iterator the first item that wasn't pushed, last on success
+   */
+  template <class Iterator>
+  Iterator try_push(Iterator first, Iterator last) {
+    const int n = static_cast<int>(std::distance(first, last));
+    if (!reserve(n)) return first;
+    int left = n;
+    for (; first != last; ++first, --left) {
+      Message copy(*first);
+      if (!try_dispatch(copy, choose(copy.size, all), all, false)) break;
+    }
+    queued.fetch_sub(left, std::memory_order_relaxed);
+    return first;
+  }
+  /**
+   * @brief Push an item that only some replicas may run
+   *
+   * @param item
+   * @param targets bit i: replica i may run the item, see device_mask
+   */
+  void push_to(Message&& item, std::uint64_t targets) {
+    dispatch(std::move(item), targets & all, true);
+  }
+  /**
+   * @brief Push an item that only some replicas may run, never blocks
+   *
+   * @param item moved from only on success
+   * @param targets bit i: replica i may run the item, see device_mask
+   * @return false if the queues of all the targets are full
+   */
+  bool try_push_to(Message&& item, std::uint64_t targets) {
+    targets &= all;
+    if (targets == 0) throw std::logic_error("Dispatcher: no target replica");
+    if (!reserve(1)) return false;
+    if (try_dispatch(item, choose(item.size, targets), targets, true)) {
+      return true;
+    }
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  /**
+   * @brief The replicas of a device
+   *
+   * @param name the device, or its last word, e.g. "intel cpu" or "cpu"
+   * @return std::uint64_t bit i: replica i runs on the device
+   */
+  std::uint64_t device_mask(const std::string& name) const {
+    std::uint64_t mask = 0;
+    const size_t n = name.size();
+    for (size_t i = 0; i < replicas.size() && n != 0; ++i) {
+      const std::string& device = replicas[i]->device;
+      const bool last_word = device.size() > n &&
+                             device.compare(device.size() - n, n, name) == 0 &&
+                             device[device.size() - n - 1] == ' ';
+      if (device == name || last_word) mask |= std::uint64_t(1) << i;
+    }
+    return mask;
+  }
+  /**
+   * @brief Pop an item for a replica, wait while its queues and the queues
+   * of the other replicas are empty
+   *
+   * @param index of the replica
+   * @return Message
+   */
+  Message pop(size_t index) {
+    replica& r = *replicas[index];
+    Message ret;
+    for (int i = 0; i < spin_count(); ++i) {
+      if (take(r, ret)) return ret;
+      cpu_relax();
+    }
+    for (;;) {
+      const std::uint32_t key = consumers.prepare_wait();
+      if (take(r, ret)) {
+        consumers.cancel_wait();
+        return ret;
+      }
+      consumers.wait(key);
+    }
+  }
+  /**
+   * @brief Pop a batch of items for a replica
+   * @details Block until there is at least one item, then keep taking items,
+   * from the queues of the replica first, until the batch is full or
+   * max_delay has passed since the first item was taken
+   * @param index of the replica
+   * @param batch where the items are appended to
+   * @param max_batch maximum number of items in the batch
+   * @param max_delay maximum time to wait for the batch to be full
+   */
+  template <class Rep, class Period>
+  void pop_batch(size_t index, std::vector<Message>& batch, size_t max_batch,
+                 const std::chrono::duration<Rep, Period>& max_delay) {
+    replica& r = *replicas[index];
+    const size_t target = batch.size() + std::max<size_t>(max_batch, 1);
+    batch.push_back(pop(index));
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<
+                              std::chrono::steady_clock::duration>(max_delay);
+    Message item;
+    while (batch.size() < target) {
+      if (take(r, item)) {
+        batch.push_back(std::move(item));
+        continue;
+      }
+      const std::uint32_t key = consumers.prepare_wait();
+      if (take(r, item)) {
+        consumers.cancel_wait();
+        batch.push_back(std::move(item));
+        continue;
+      }
+      if (!consumers.wait_until(key, deadline)) break;
+    }
+  }
+  /**
+   * @brief Report that a replica is done with an item it popped
+   *
+   * @param index of the replica
+   * @param size of the input of the item
+   * @param elapsed service time of the item
+   */
+  void done(size_t index, int size, std::chrono::nanoseconds elapsed) {
+    replica& r = *replicas[index];
+    r.service.record(size, elapsed.count());
+    r.busy.fetch_sub(1, std::memory_order_relaxed);
+  }
+  /**
+   * @brief Report that a replica dropped an item it popped, because its
+   * deadline had passed
+   *
+   * @param index of the replica
+   */
+  void drop(size_t index) {
+    replicas[index]->busy.fetch_sub(1, std::memory_order_relaxed);
+    expired_count.fetch_add(1, std::memory_order_relaxed);
+  }
+  /**
+   * @brief Report that a replica failed to run an item it popped, the item
+   * is not a sample of its service time
+   *
+   * @param index of the replica
+   */
+  void fail(size_t index) {
+    replicas[index]->busy.fetch_sub(1, std::memory_order_relaxed);
+  }
+  /**
+   * @brief Number of items dropped since the start
+   *
+   * @return std::uint64_t
+   */
+  std::uint64_t expired() const {
+    return expired_count.load(std::memory_order_relaxed);
+  }
+  /**
+   * @brief Set the limits of admission, before the producers start
+   * @details max_queued is enforced by try_push and try_push_to, which
+   * count the tasks as they admit them. It defaults to the capacity of the
+   * queues of all the replicas. max_delay is only checked by overloaded.
+   * @param _limits
+   */
+  void set_admission(const admission_limits& _limits) {
+    limits = _limits;
+    if (limits.max_queued <= 0) {
+      limits.max_queued =
+          static_cast<int>(replicas.size() * replicas[0]->queue.capacity());
+    }
+  }
+  /**
+   * @brief Predicted wait of a new task before a replica starts it
+   * @details The tasks held by all the replicas, queued or running, divided
+   * by the service rate of the replicas, measured by done
+   * @return std::chrono::nanoseconds 0 before the first sample
+   */
+  std::chrono::nanoseconds predicted_delay() const {
+    const double rate = service_rate();
+    if (rate == 0) return std::chrono::nanoseconds(0);
+    std::int64_t held = 0;
+    for (const auto& r : replicas) held += backlog(*r);
+    return std::chrono::nanoseconds(static_cast<std::int64_t>(held / rate));
+  }
+  /**
+   * @brief Whether a request of more tasks than max_queued could ever be
+   * admitted, such a request is malformed rather than early
+   *
+   * @param incoming number of tasks of the request
+   * @return true if the request can never be admitted
+   */
+  bool too_large(int incoming) const {
+    return limits.max_queued > 0 && incoming > limits.max_queued;
+  }
+  /**
+   * @brief Whether a request should be turned away before it is read, see
+   * set_admission
+   * @details A snapshot that saves the work of reading and pushing a request
+   * that wouldn't fit, try_push still has the last word. A request that is
+   * too_large is not overloaded, it is rejected on its own.
+   * @param incoming number of tasks of the request
+   * @param retry_after time to drain the excess, 0 before the first sample
+   * @return true if the request would exceed a limit
+   */
+  bool overloaded(int incoming, std::chrono::nanoseconds& retry_after) const {
+    bool over = false;
+    retry_after = std::chrono::nanoseconds(0);
+    if (limits.max_queued > 0 && !too_large(incoming)) {
+      const int excess = size() + incoming - limits.max_queued;
+      if (excess > 0) {
+        over = true;
+        const double rate = service_rate();
+        if (rate != 0) {
+          retry_after = std::chrono::nanoseconds(
+              static_cast<std::int64_t>(excess / rate));
+        }
+      }
+    }
+    if (limits.max_delay.count() > 0) {
+      const std::chrono::nanoseconds delay = predicted_delay();
+      if (delay > limits.max_delay) {
+        over = true;
+        retry_after = std::max<std::chrono::nanoseconds>(
+            retry_after, delay - limits.max_delay);
+      }
+    }
+    return over;
+  }
+  /**
+   * @brief Get current number of item in all the queues, the ones pushed
+   * and not taken yet
+   *
+   * @return int
+   */
+  int size() const { return queued.load(std::memory_order_relaxed); }
+  /**
+   * @brief Get current number of item in the queues of a replica
+   *
+   * @param index of the replica
+   * @return int
+   */
+  int size(size_t index) const {
+    return replicas[index]->queue.size() + replicas[index]->pinned.size();
+  }
+  /**
+   * @brief Predicted service time of a replica for an input
+   *
+   * @param index of the replica
+   * @param size of the input
+   * @return std::int64_t nanoseconds, 0 before the first sample
+   */
+  std::int64_t predict(size_t index, int size) const {
+    return replicas[index]->service.predict(size);
+  }
+  /**
+   * @brief Number of replicas
+   *
+   * @return size_t
+   */
+  size_t num_replicas() const { return replicas.size(); }
+  using ptr = std::shared_ptr<dispatcher>;
+
+ private:
+  /**
+   * @brief The queues of a replica and the replicas it may steal from
+   *
+   */
+  struct replica {
+    replica(size_t capacity, const std::string& _device)
+        : queue(capacity), pinned(capacity), device(_device) {}
+    deadline_queue<Message> queue;   //!< may be stolen by the others
+    deadline_queue<Message> pinned;  //!< pushed with push_to, never stolen
+    std::string device;
+    std::uint64_t mask = 0;  //!< bit j: may steal from replica j
+    service_time service;
+    std::atomic<int> busy{0};  //!< popped and not done yet
+  };
+  std::vector<std::unique_ptr<replica>> replicas;
+  std::uint64_t all = 0;  //!< bits of all the replicas
+  event_count consumers;  //!< the consumers of all the replicas sleep on it
+  schedule_policy policy;
+  std::atomic<std::uint64_t> expired_count{0};  //!< see drop
+  admission_limits limits;
+  std::atomic<int> queued{0};  //!< pushed and not taken, see reserve
+
+  // count n tasks against max_queued, all or none
+  bool reserve(int n) {
+    const int before = queued.fetch_add(n, std::memory_order_relaxed);
+    if (limits.max_queued > 0 && before + n > limits.max_queued) {
+      queued.fetch_sub(n, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+  void dispatch(Message&& item, std::uint64_t targets, bool pin) {
+    if (targets == 0) throw std::logic_error("Dispatcher: no target replica");
+    // the blocking path waits for room instead of being turned away
+    queued.fetch_add(1, std::memory_order_relaxed);
+    const size_t index = choose(item.size, targets);
+    if (try_dispatch(item, index, targets, pin)) return;
+    replica& r = *replicas[index];
+    (pin ? r.pinned : r.queue).push(std::move(item));
+    wake(pin);
+  }
+  // push to the chosen replica, if its queue is full any other target will do
+  bool try_dispatch(Message& item, size_t index, std::uint64_t targets,
+                    bool pin) {
+    if (push_at(index, item, pin)) return true;
+    const size_t n = replicas.size();
+    const size_t start = next_random() % n;
+    for (size_t k = 0; k < n; ++k) {
+      const size_t j = (start + k) % n;
+      if ((targets >> j & 1) && push_at(j, item, pin)) return true;
+    }
+    return false;
+  }
+  bool push_at(size_t index, Message& item, bool pin) {
+    replica& r = *replicas[index];
+    if (!(pin ? r.pinned : r.queue).try_push(std::move(item))) return false;
+    wake(pin);
+    return true;
+  }
+  void wake(bool pin) {
+    // any consumer can take an item of the queue, by stealing, but only the
+    // owner can take a pinned one, and with earliest finish a slow consumer
+    // may leave the item to the owner
+    if (pin || policy == schedule_policy::EARLIEST_FINISH) {
+      consumers.notify_all();
+    } else {
+      consumers.notify_one();
+    }
+  }
+  size_t choose(int size, std::uint64_t targets) const {
+    const int count = __builtin_popcountll(targets);
+    if (count == 1) return __builtin_ctzll(targets);
+    if (policy == schedule_policy::TWO_CHOICES) {
+      const int a = next_random() % count;
+      int b = next_random() % (count - 1);
+      if (b >= a) ++b;
+      const size_t first = nth_target(targets, a);
+      const size_t second = nth_target(targets, b);
+      return backlog(*replicas[second]) < backlog(*replicas[first]) ? second
+                                                                     : first;
+    }
+    // replicas without sample are predicted as fast as the fastest one
+    std::int64_t fastest = 0;
+    for (const auto& r : replicas) {
+      const std::int64_t t = r->service.average();
+      if (t != 0 && (fastest == 0 || t < fastest)) fastest = t;
+    }
+    if (fastest == 0) fastest = 1;
+    // ties go to a random replica
+    const size_t n = replicas.size();
+    const size_t start = next_random() % n;
+    size_t best = n;
+    std::int64_t best_finish = 0;
+    for (size_t k = 0; k < n; ++k) {
+      const size_t j = (start + k) % n;
+      if (!(targets >> j & 1)) continue;
+      const replica& r = *replicas[j];
+      const std::int64_t average = r.service.average();
+      const std::int64_t each = average != 0 ? average : fastest;
+      const std::int64_t own = average != 0 ? r.service.predict(size) : each;
+      const std::int64_t finish = backlog(r) * each + own;
+      if (best == n || finish < best_finish) {
+        best = j;
+        best_finish = finish;
+      }
+    }
+    return best;
+  }
+  // tasks per nanosecond of all the replicas with a sample
+  double service_rate() const {
+    double rate = 0;
+    for (const auto& r : replicas) {
+      const std::int64_t t = r->service.average();
+      if (t != 0) rate += 1.0 / t;
+    }
+    return rate;
+  }
+  // items held by a replica, in its queues or running
+  static std::int64_t backlog(const replica& r) {
+    return r.queue.size() + r.pinned.size() +
+           r.busy.load(std::memory_order_relaxed);
+  }
+  // index of the k-th replica of targets
+  static size_t nth_target(std::uint64_t targets, int k) {
+    for (; k > 0; --k) targets &= targets - 1;
+    return __builtin_ctzll(targets);
+  }
+  // pop from the queues of the replica, or steal from the others
+  bool take(replica& r, Message& item) {
+    if (!r.pinned.try_pop(item) && !r.queue.try_pop(item) &&
+        !steal(r, item)) {
+      return false;
+    }
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    r.busy.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  bool steal(replica& r, Message& item) {
+    if (r.mask == 0) return false;
+    // start at a random victim so that thieves don't all hit the same queue
+    const size_t n = replicas.size();
+    const size_t start = next_random() % n;
+    for (size_t k = 0; k < n; ++k) {
+      const size_t j = (start + k) % n;
+      if ((r.mask >> j & 1) && worth_stealing(r, *replicas[j]) &&
+          replicas[j]->queue.try_pop(item)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // with earliest finish, a slow thief doesn't take an item that the victim
+  // would finish before it, the last item of the victim waits backlog times
+  // its average service time
+  bool worth_stealing(const replica& thief, const replica& victim) const {
+    if (policy != schedule_policy::EARLIEST_FINISH) return true;
+    const std::int64_t own = thief.service.average();
+    const std::int64_t each = victim.service.average();
+    return own == 0 || each == 0 || own < backlog(victim) * each;
+  }
+  // cheap per-thread random numbers, xorshift
+  static std::uint32_t next_random() {
+    static thread_local std::uint32_t state = static_cast<std::uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+};
+
+}  // namespace sync
+}  // namespace st
@@ -0,0 +1,49 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement thin wrappers of the Linux futex, the
+ * sleeping primitive of the lock-free synchronization objects
+ ***************************************************************************************/
+
+#pragma once
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+
+namespace st {
+namespace sync {
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+              "a futex word must be 32 bits");
+
+/**
+ * @brief Sleep while the word holds value
+ * @details Returns at once if the word doesn't hold value, and may return
+ * spuriously, the caller checks its condition again
+ * @param word
+ * @param value
+ * @param timeout relative timeout, nullptr to wait forever
+ */
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t value,
+                       const timespec* timeout = nullptr) {
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+          FUTEX_WAIT_PRIVATE, value, timeout, nullptr, 0);
+}
+
+/**
+ * @brief Wake up threads sleeping on the word
+ *
+ * @param word
+ * @param count maximum number of threads to wake up
+ */
+inline void futex_wake(std::atomic<std::uint32_t>& word, int count = INT_MAX) {
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word),
+          FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+}  // namespace sync
+}  // namespace st
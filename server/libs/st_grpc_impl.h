@@ -5,22 +5,38 @@
  * stubs/inference_rpc.proto
  ***************************************************************************************/
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include "stubs/inference_rpc.grpc.pb.h"
 #include "stubs/inference_rpc.pb.h"
 #include "st_utils.h"
-#include "st_ie_common.h" 
+#include "st_ie_types.h"
 
 using grpc::Server;
+using grpc::ServerAsyncReaderWriter;
+using grpc::ServerAsyncResponseWriter;
 using grpc::ServerBuilder;
+using grpc::ServerCompletionQueue;
 using grpc::ServerContext;
 using grpc::Status;
 using st::rpc::encoded_image;
 using st::rpc::detection_output;
+using st::rpc::detection_output_batch;
+using st::rpc::encoded_image_batch;
+using st::rpc::frame_result;
+using st::rpc::video_frame;
+using st::rpc::packed_detection_output;
+using st::rpc::raw_format;
 using st::rpc::inference_rpc;
 using namespace st::sync;
 using namespace st::worker;
@@ -30,57 +46,645 @@ using namespace st::log;
 namespace st {
 namespace rpc {
 /**
- * @brief service implementation
- * 
+ * @brief Base class of all in-flight calls
+ * @details The address of the call is the tag that we register with the
+ * completion queue. When the tag comes back from the queue, the polling
+ * thread calls proceed() to move the call to its next state.
  */
-class inference_rpc_impl final : public inference_rpc::Service {
+class rpc_call {
   public:
-    inference_rpc_impl(object_detection_mq<single_bell>::ptr& _taskq) : 
-      inference_rpc::Service() , taskq(_taskq) {
-        bell = std::make_shared<single_bell>();
-      };
-    virtual Status run_detection(ServerContext* context, const encoded_image* request, detection_output* response) override {
-      auto data = request->data().c_str();
-      int sz = request->size();
-      std::vector<bbox> prediction;
-      obj_detection_msg<single_bell> m{data, sz, &prediction, bell};
-      rpc_log->debug("Enqueue my task, current queue size {}",
-              taskq->size());
-      taskq->push(m);
-      rpc_log->debug("Waiting for inference engine");
-      bell->wait(1);
+    virtual ~rpc_call() {}
+    /**
+     * @brief Move the call to the next state
+     *
+     * @param ok the status of the event returned by the completion queue
+     */
+    virtual void proceed(bool ok) = 0;
+}; // class rpc_call
+
+/**
+ * @brief Ask the service for the next call of the method that returns Reply
+ *
+ */
+inline void request_call(inference_rpc::AsyncService* service,
+                         ServerContext* ctx, encoded_image* request,
+                         ServerAsyncResponseWriter<detection_output>* responder,
+                         ServerCompletionQueue* cq, void* tag) {
+  service->Requestrun_detection(ctx, request, responder, cq, cq, tag);
+}
+inline void request_call(
+    inference_rpc::AsyncService* service, ServerContext* ctx,
+    encoded_image* request,
+    ServerAsyncResponseWriter<packed_detection_output>* responder,
+    ServerCompletionQueue* cq, void* tag) {
+  service->Requestrun_detection_packed(ctx, request, responder, cq, cq, tag);
+}
+
+/**
+ * @brief Read the raw frame format of a request
+ *
+ * @param request
+ * @param format
+ * @return false if the frame doesn't match its data
+ */
+inline bool read_image_format(const encoded_image& request,
+                              image_format& format) {
+  if (!request.has_raw()) return true;
+  const raw_format& raw = request.raw();
+  switch (raw.format()) {
+    case raw_format::BGR:
+      format.format = pixel_format::BGR;
+      break;
+    case raw_format::RGB:
+      format.format = pixel_format::RGB;
+      break;
+    case raw_format::NV12:
+      format.format = pixel_format::NV12;
+      break;
+    default:
+      format.format = pixel_format::ENCODED;
+      return true;
+  }
+  format.width = raw.width();
+  format.height = raw.height();
+  format.stride = raw.stride();
+  return format.valid(request.data().size());
+}
+
+/**
+ * @brief Read the options of an image
+ *
+ * @param image
+ * @param params
+ * @return false if the image is a raw frame that doesn't match its data
+ */
+inline bool read_params(const encoded_image& image, inference_params& params) {
+  // zero is the default value of proto3, keep the engine default
+  params.top_k = image.top_k();
+  // min_confidence is optional, so that a client can ask for 0
+  if (image.has_min_confidence() && image.min_confidence() >= 0) {
+    params.min_confidence = image.min_confidence();
+  }
+  return read_image_format(image, params.input);
+}
+
+/**
+ * @brief Fill the reply of run_detection
+ *
+ */
+inline void fill_reply(const detection_result& prediction,
+                       const encoded_image& request, detection_output& reply) {
+  int n = prediction.size();
+  for (int i = 0; i < n; ++i) {
+    const bbox& pred = prediction.boxes[i];
+    auto rpc_bbox = reply.add_bboxes();
+    rpc_bbox->set_label_id(pred.label_id);
+    rpc_bbox->set_label(prediction.label(pred));
+    rpc_bbox->set_prob(pred.prop);
+    if (pred.c[3]) {
+      st::rpc::detection_output_rectangle *rec = new st::rpc::detection_output_rectangle();
+      rec->set_xmin(static_cast<int>(pred.c[0]));
+      rec->set_ymin(static_cast<int>(pred.c[1]));
+      rec->set_xmax(static_cast<int>(pred.c[2]));
+      rec->set_ymax(static_cast<int>(pred.c[3]));
+      rpc_bbox->set_allocated_box(rec);
+    }
+  }
+}
+
+/**
+ * @brief Fill the reply of run_detection_packed
+ * @details The fields are packed arrays without any per-box message, and the
+ * label names are only sent when the client asks for them
+ */
+inline void fill_reply(const detection_result& prediction,
+                       const encoded_image& request,
+                       packed_detection_output& reply) {
+  const int n = prediction.size();
+  reply.mutable_label_id()->Reserve(n);
+  reply.mutable_prob()->Reserve(n);
+  reply.mutable_box()->Reserve(4 * n);
+  for (const bbox& pred : prediction.boxes) {
+    reply.add_label_id(pred.label_id);
+    reply.add_prob(pred.prop);
+    for (int i = 0; i < 4; ++i) reply.add_box(static_cast<int>(pred.c[i]));
+  }
+  if (request.with_labels() && prediction.labels) {
+    const int num_labels = prediction.labels->size();
+    for (int id = 1; id <= num_labels; ++id) {
+      reply.add_labels(prediction.labels->name(id));
+    }
+  }
+}
+
+/**
+ * @brief Deadline of a call on the steady clock
+ * @details gRPC gives the deadline of the client on the system clock, a call
+ * without deadline, or with one a day or more away, gets none
+ * @param ctx
+ * @return std::chrono::steady_clock::time_point
+ */
+inline std::chrono::steady_clock::time_point call_deadline(
+    const ServerContext& ctx) {
+  const auto deadline = ctx.deadline();
+  const auto now = std::chrono::system_clock::now();
+  if (deadline == std::chrono::system_clock::time_point::max() ||
+      deadline - now >= std::chrono::hours(24)) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return std::chrono::steady_clock::now() +
+         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+             deadline - now);
+}
+
+/**
+ * @brief Status of a call turned away by the admission control
+ * @details The time the client should wait before it retries is sent in the
+ * retry-after-ms trailer
+ * @param ctx
+ * @param retry_after
+ * @return Status RESOURCE_EXHAUSTED
+ */
+inline Status overload_status(ServerContext& ctx,
+                              std::chrono::nanoseconds retry_after) {
+  const long long ms = std::max<long long>(
+      1, std::chrono::duration_cast<std::chrono::milliseconds>(retry_after)
+             .count());
+  ctx.AddTrailingMetadata("retry-after-ms", std::to_string(ms));
+  return Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Server overloaded");
+}
+
+/**
+ * @brief One in-flight run_detection or run_detection_packed call
+ * @details Each call owns its context, request, reply and bell, so concurrent
+ * calls never share any state. The call waits for a client, pushes the task
+ * to the inference workers, and the inference worker finishes the RPC when
+ * it rings the bell. No gRPC thread is blocked during the inference.
+ * @tparam Reply detection_output or packed_detection_output
+ */
+template <class Reply>
+class detection_call final : public rpc_call {
+  public:
+    detection_call(inference_rpc::AsyncService* _service,
+                   ServerCompletionQueue* _cq,
+                   object_detection_mq<latch_bell>::ptr& _taskq)
+        : service(_service),
+          cq(_cq),
+          taskq(_taskq),
+          responder(&ctx),
+          state(call_state::REQUEST) {
+      // ask the service to start processing a new run_detection call, the
+      // completion queue will return us when a client arrives
+      request_call(service, &ctx, &request, &responder, cq, this);
+    }
+    void proceed(bool ok) override {
+      if (state == call_state::REQUEST) {
+        if (!ok) {
+          // the server is shutting down
+          delete this;
+          return;
+        }
+        // spawn a new call to serve the next client while we process this one
+        new detection_call<Reply>(service, cq, taskq);
+        std::chrono::nanoseconds retry_after;
+        if (taskq->overloaded(1, retry_after)) {
+          state = call_state::FINISH;
+          responder.FinishWithError(overload_status(ctx, retry_after), this);
+          return;
+        }
+        auto data = request.data().c_str();
+        int sz = request.data().size();
+        // the inference worker finishes the call in its own thread, the
+        // completion queue is thread-safe
+        bell.on_ring<detection_call, &detection_call::on_inference_done>(this);
+        obj_detection_msg<latch_bell> m{data, sz, &prediction, &bell};
+        m.deadline = call_deadline(ctx);
+        if (!read_params(request, m.params)) {
+          state = call_state::FINISH;
+          responder.FinishWithError(
+              Status(grpc::StatusCode::INVALID_ARGUMENT,
+                     "Illegal raw image format"),
+              this);
+          return;
+        }
+        rpc_log->debug("Enqueue my task, current queue size {}",
+                taskq->size());
+        // the pollers never wait for the engines, a call that doesn't fit in
+        // the queues is turned away like an overloaded one
+        if (!taskq->try_push(std::move(m))) {
+          prediction.rejected = true;
+          bell.ring();
+        }
+      } else {
+        // FINISH: the reply has been sent, we are done with this call
+        delete this;
+      }
+    }
+  private:
+    enum class call_state { REQUEST, FINISH };
+    inference_rpc::AsyncService* service;
+    ServerCompletionQueue* cq;
+    object_detection_mq<latch_bell>::ptr taskq;
+    ServerContext ctx;
+    encoded_image request;
+    Reply reply;
+    ServerAsyncResponseWriter<Reply> responder;
+    detection_result prediction;
+    latch_bell bell;
+    call_state state;
+    /**
+     * @brief Fill the reply and finish the call
+     *
+     */
+    void on_inference_done() {
       rpc_log->debug("Received data");
-      int n = prediction.size();
-      for (int i = 0; i < n; ++i) {
-        bbox& pred = prediction[i];
-        auto rpc_bbox = response->add_bboxes();
-        rpc_bbox->set_label_id(pred.label_id);
-        rpc_bbox->set_label(pred.label);
-        rpc_bbox->set_prob(pred.prop);
-        if (pred.c[3]) {
-          st::rpc::detection_output_rectangle *rec = new st::rpc::detection_output_rectangle();
-          rec->set_xmin(pred.c[0]);
-          rec->set_ymin(pred.c[1]);
-          rec->set_xmax(pred.c[2]);
-          rec->set_ymax(pred.c[3]);
-          rpc_bbox->set_allocated_box(rec);
+      state = call_state::FINISH;
+      if (prediction.rejected) {
+        responder.FinishWithError(
+            overload_status(ctx, taskq->predicted_delay()), this);
+        return;
+      }
+      if (prediction.expired) {
+        responder.FinishWithError(
+            Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded"),
+            this);
+        return;
+      }
+      if (prediction.failed) {
+        responder.FinishWithError(
+            Status(grpc::StatusCode::INTERNAL, "Inference failed"), this);
+        return;
+      }
+      fill_reply(prediction, request, reply);
+      responder.Finish(reply, Status::OK, this);
+    }
+}; // class detection_call
+
+/**
+ * @brief One in-flight run_detection_batch call
+ * @details The images of the call are pushed to the queue at once and share
+ * the bell of the call, which finishes the RPC when the last image is done.
+ */
+class batch_call final : public rpc_call {
+  public:
+    batch_call(inference_rpc::AsyncService* _service,
+               ServerCompletionQueue* _cq,
+               object_detection_mq<latch_bell>::ptr& _taskq,
+               int _max_images)
+        : service(_service),
+          cq(_cq),
+          taskq(_taskq),
+          max_images(_max_images),
+          responder(&ctx),
+          state(call_state::REQUEST) {
+      service->Requestrun_detection_batch(&ctx, &request, &responder, cq, cq,
+                                          this);
+    }
+    void proceed(bool ok) override {
+      if (state == call_state::REQUEST) {
+        if (!ok) {
+          delete this;
+          return;
+        }
+        new batch_call(service, cq, taskq, max_images);
+        const int n = request.images_size();
+        if (n > max_images) {
+          return finish_with_error("Too many images");
         }
+        if (taskq->too_large(n)) {
+          return finish_with_error("More images than the server queues");
+        }
+        std::chrono::nanoseconds retry_after;
+        if (n != 0 && taskq->overloaded(n, retry_after)) {
+          state = call_state::FINISH;
+          responder.FinishWithError(overload_status(ctx, retry_after), this);
+          return;
+        }
+        predictions.resize(n);
+        const auto deadline = call_deadline(ctx);
+        std::vector<obj_detection_msg<latch_bell>> tasks;
+        tasks.reserve(n);
+        for (int i = 0; i < n; ++i) {
+          const encoded_image& image = request.images(i);
+          auto data = image.data().c_str();
+          int sz = image.data().size();
+          obj_detection_msg<latch_bell> m{data, sz, &predictions[i], &bell};
+          if (!read_params(image, m.params)) {
+            return finish_with_error("Illegal raw image format");
+          }
+          m.deadline = deadline;
+          tasks.push_back(m);
+        }
+        if (n == 0) return on_inference_done();
+        bell.on_ring<batch_call, &batch_call::on_inference_done>(this, n);
+        rpc_log->debug("Enqueue {} tasks, current queue size {}", n,
+                       taskq->size());
+        // the images that don't fit in the queues ring the bell themselves,
+        // flagged before the first ring since the last one finishes the call
+        const auto queued = taskq->try_push(tasks.begin(), tasks.end());
+        for (auto it = queued; it != tasks.end(); ++it) {
+          it->predictions->rejected = true;
+        }
+        for (auto it = queued; it != tasks.end(); ++it) bell.ring();
+      } else {
+        delete this;
       }
-      return Status::OK;
     }
   private:
-  object_detection_mq<single_bell>::ptr taskq;
-  single_bell::ptr bell;
-}; // class inference_rpc_impl
+    enum class call_state { REQUEST, FINISH };
+    inference_rpc::AsyncService* service;
+    ServerCompletionQueue* cq;
+    object_detection_mq<latch_bell>::ptr taskq;
+    int max_images;
+    ServerContext ctx;
+    encoded_image_batch request;
+    detection_output_batch reply;
+    ServerAsyncResponseWriter<detection_output_batch> responder;
+    std::vector<detection_result> predictions;
+    latch_bell bell;
+    call_state state;
+    void finish_with_error(
+        const char* why,
+        grpc::StatusCode code = grpc::StatusCode::INVALID_ARGUMENT) {
+      state = call_state::FINISH;
+      responder.FinishWithError(Status(code, why), this);
+    }
+    /**
+     * @brief Fill the reply, in the order of the images, and finish the call
+     *
+     */
+    void on_inference_done() {
+      rpc_log->debug("Received batch");
+      for (const auto& prediction : predictions) {
+        if (prediction.rejected) {
+          state = call_state::FINISH;
+          responder.FinishWithError(
+              overload_status(ctx, taskq->predicted_delay()), this);
+          return;
+        }
+      }
+      // the images share the deadline, any of them dropped fails the call
+      for (const auto& prediction : predictions) {
+        if (prediction.expired) {
+          return finish_with_error("Deadline exceeded",
+                                   grpc::StatusCode::DEADLINE_EXCEEDED);
+        }
+      }
+      for (const auto& prediction : predictions) {
+        if (prediction.failed) {
+          return finish_with_error("Inference failed",
+                                   grpc::StatusCode::INTERNAL);
+        }
+      }
+      for (int i = 0; i < request.images_size(); ++i) {
+        fill_reply(predictions[i], request.images(i), *reply.add_outputs());
+      }
+      state = call_state::FINISH;
+      responder.Finish(reply, Status::OK, this);
+    }
+}; // class batch_call
+
+/**
+ * @brief One stream_detection call
+ * @details The call keeps reading frames while they run, so that it always
+ * knows the latest one. At most max_in_flight frames of the stream are in
+ * the task queue or in the engine at a time, each one in a slot that owns
+ * its data, its prediction and its bell. A frame that arrives while all the
+ * slots are busy waits as the pending frame. If a newer frame arrives first,
+ * the pending frame is dropped and reported as such, like a frame that finds
+ * the task queues full. The latency of a stream therefore stays bounded when
+ * the client sends faster than the engine.
+ *
+ * Reads, writes and inference completions run in different threads, the
+ * state of the call is guarded by a mutex. gRPC allows one read and one write
+ * in flight, the results wait in the outbox for their turn. The call finishes
+ * once the client is done sending and every frame has been answered.
+ */
+class stream_call {
+  public:
+    stream_call(inference_rpc::AsyncService* _service,
+                ServerCompletionQueue* _cq,
+                object_detection_mq<latch_bell>::ptr& _taskq,
+                int _max_in_flight)
+        : service(_service),
+          cq(_cq),
+          taskq(_taskq),
+          stream(&ctx),
+          slots(std::max(1, _max_in_flight)),
+          connect_op(this, &stream_call::on_connect),
+          read_op(this, &stream_call::on_read),
+          write_op(this, &stream_call::on_write),
+          finish_op(this, &stream_call::on_finish) {
+      for (auto& slot : slots) slot.call = this;
+      service->Requeststream_detection(&ctx, &stream, cq, cq, &connect_op);
+    }
+  private:
+    /**
+     * @brief Completion queue tag of one kind of operation of the call
+     *
+     */
+    class op final : public rpc_call {
+      public:
+        op(stream_call* _call, void (stream_call::*_fn)(bool))
+            : call(_call), fn(_fn) {}
+        void proceed(bool ok) override { (call->*fn)(ok); }
+      private:
+        stream_call* call;
+        void (stream_call::*fn)(bool);
+    };
+    /**
+     * @brief A frame in the task queue or in the engine
+     *
+     */
+    struct frame_slot {
+      video_frame frame;
+      detection_result prediction;
+      latch_bell bell;
+      stream_call* call = nullptr;
+      bool busy = false;
+      void on_rung() { call->on_inference_done(this); }
+    };
+    inference_rpc::AsyncService* service;
+    ServerCompletionQueue* cq;
+    object_detection_mq<latch_bell>::ptr taskq;
+    ServerContext ctx;
+    ServerAsyncReaderWriter<frame_result, video_frame> stream;
+    std::vector<frame_slot> slots;
+    op connect_op, read_op, write_op, finish_op;
+    std::mutex mtx;  //!< guards everything below
+    video_frame incoming;  //!< target of the read in flight
+    video_frame pending;   //!< latest frame waiting for a slot
+    bool has_pending = false;
+    std::deque<frame_result> outbox;  //!< results waiting for the write
+    frame_result writing_result;      //!< source of the write in flight
+    bool writing = false;
+    bool read_closed = false;  //!< the client is done sending
+    bool write_failed = false;  //!< the client is gone
+    bool finishing = false;
+
+    void on_connect(bool ok) {
+      if (!ok) {
+        // the server is shutting down
+        delete this;
+        return;
+      }
+      new stream_call(service, cq, taskq, slots.size());
+      rpc_log->debug("New stream");
+      std::lock_guard<std::mutex> lk(mtx);
+      stream.Read(&incoming, &read_op);
+    }
+    void on_read(bool ok) {
+      std::unique_lock<std::mutex> lk(mtx);
+      if (!ok) {
+        read_closed = true;
+        return maybe_finish(lk);
+      }
+      frame_slot* slot = free_slot();
+      std::chrono::nanoseconds retry_after;
+      if (slot != nullptr && taskq->overloaded(1, retry_after)) {
+        // the stream goes on, the frame is reported as dropped
+        push_dropped(incoming.sequence());
+      } else if (slot != nullptr) {
+        dispatch(*slot, incoming);
+      } else {
+        if (has_pending) push_dropped(pending.sequence());
+        pending.Swap(&incoming);
+        has_pending = true;
+      }
+      stream.Read(&incoming, &read_op);
+    }
+    void on_inference_done(frame_slot* slot) {
+      std::unique_lock<std::mutex> lk(mtx);
+      frame_result result;
+      result.set_sequence(slot->frame.sequence());
+      if (slot->prediction.expired || slot->prediction.failed) {
+        // past the deadline of the call, or failed by the engine, reported
+        // like a replaced frame
+        result.set_dropped(true);
+      } else {
+        fill_reply(slot->prediction, slot->frame.image(),
+                   *result.mutable_output());
+      }
+      slot->busy = false;
+      push_result(std::move(result));
+      if (has_pending) {
+        has_pending = false;
+        dispatch(*slot, pending);
+      }
+      maybe_finish(lk);
+    }
+    void on_write(bool ok) {
+      std::unique_lock<std::mutex> lk(mtx);
+      writing = false;
+      if (!ok) {
+        write_failed = true;
+        outbox.clear();
+      }
+      next_write();
+      maybe_finish(lk);
+    }
+    void on_finish(bool ok) {
+      rpc_log->debug("Stream closed");
+      // nothing else is in flight, see maybe_finish, but the thread that
+      // started the finish may still be releasing the mutex
+      { std::lock_guard<std::mutex> lk(mtx); }
+      delete this;
+    }
+    frame_slot* free_slot() {
+      for (auto& slot : slots) {
+        if (!slot.busy) return &slot;
+      }
+      return nullptr;
+    }
+    // push a frame to the queue, the frame is moved to the slot, never blocks
+    // since it also runs on the inference workers: a frame that doesn't fit
+    // in the queues is reported as dropped
+    void dispatch(frame_slot& slot, video_frame& frame) {
+      slot.frame.Swap(&frame);
+      slot.prediction.clear();
+      const std::string& image = slot.frame.image().data();
+      auto data = image.c_str();
+      int sz = image.size();
+      obj_detection_msg<latch_bell> m{data, sz, &slot.prediction,
+                                      &slot.bell};
+      // a raw frame that doesn't match its data is not run, the unary calls
+      // fail with INVALID_ARGUMENT for it
+      if (!read_params(slot.frame.image(), m.params)) {
+        return push_dropped(slot.frame.sequence());
+      }
+      m.deadline = call_deadline(ctx);
+      slot.bell.on_ring<frame_slot, &frame_slot::on_rung>(&slot);
+      if (taskq->try_push(std::move(m))) {
+        slot.busy = true;
+      } else {
+        push_dropped(slot.frame.sequence());
+      }
+    }
+    void push_dropped(std::uint64_t sequence) {
+      frame_result dropped;
+      dropped.set_sequence(sequence);
+      dropped.set_dropped(true);
+      push_result(std::move(dropped));
+    }
+    void push_result(frame_result&& result) {
+      if (write_failed) return;
+      outbox.push_back(std::move(result));
+      next_write();
+    }
+    void next_write() {
+      if (writing || outbox.empty()) return;
+      writing_result.Swap(&outbox.front());
+      outbox.pop_front();
+      writing = true;
+      stream.Write(writing_result, &write_op);
+    }
+    // finish once nothing is left to read, run or write. The finish is
+    // started after the mutex is released, on_finish deletes the call and
+    // nothing may touch it afterwards
+    void maybe_finish(std::unique_lock<std::mutex>& lk) {
+      if (!read_closed || finishing || writing || has_pending ||
+          !outbox.empty() || free_slots() != slots.size()) {
+        return;
+      }
+      finishing = true;
+      lk.unlock();
+      stream.Finish(Status::OK, &finish_op);
+    }
+    size_t free_slots() const {
+      size_t n = 0;
+      for (auto& slot : slots) n += !slot.busy;
+      return n;
+    }
+}; // class stream_call
 
 /**
  * @brief grpc listening worker
- * 
+ * @details The worker runs the asynchronous service with a number of
+ * completion queues, each queue is polled by one or more threads.
  */
 class rpc_listen_worker {
   public:
-    rpc_listen_worker(object_detection_mq<single_bell>::ptr& _taskq)
-        : taskq(_taskq) {}
+    /**
+     * @brief Construct a new rpc listen worker object
+     *
+     * @param _taskq task queue
+     * @param _num_cqs number of completion queues
+     * @param _num_threads number of polling threads, shared round-robin
+     * between the completion queues
+     * @param _max_message_size maximum size of the received message
+     * @param _max_batch_images maximum number of images of a batch call
+     * @param _max_stream_frames maximum number of frames of a stream in the
+     * queue or in the engine
+     */
+    rpc_listen_worker(object_detection_mq<latch_bell>::ptr& _taskq,
+                      int _num_cqs, int _num_threads, int _max_message_size,
+                      int _max_batch_images, int _max_stream_frames)
+        : taskq(_taskq),
+          num_cqs(std::max(1, _num_cqs)),
+          num_threads(std::max(num_cqs, _num_threads)),
+          max_message_size(_max_message_size),
+          max_batch_images(_max_batch_images),
+          max_stream_frames(_max_stream_frames) {}
     ~rpc_listen_worker() {}
     void operator()() {
       pthread_setname_np(pthread_self(), "rpc listener");
@@ -93,25 +697,68 @@ class rpc_listen_worker {
       listen(ip.c_str(), port.c_str());
     }
   private:
-    object_detection_mq<single_bell>::ptr taskq;
+    object_detection_mq<latch_bell>::ptr taskq;
+    int num_cqs;
+    int num_threads;
+    int max_message_size;
+    int max_batch_images;
+    int max_stream_frames;
+    /**
+     * @brief Polling loop, run the state machine of the calls
+     *
+     * @param cq
+     */
+    static void poll(ServerCompletionQueue* cq) {
+      pthread_setname_np(pthread_self(), "rpc poller");
+      void* tag;
+      bool ok;
+      // Next return false when the queue is shutdown and drained
+      while (cq->Next(&tag, &ok)) {
+        static_cast<rpc_call*>(tag)->proceed(ok);
+      }
+    }
     void listen(const char* ip, const char* p) {
       std::string address(ip);
       std::string port(p);
       std::string binding = address + ":" + port;
-      inference_rpc_impl service(taskq);
+      inference_rpc::AsyncService service;
       grpc::EnableDefaultHealthCheckService(true);
       grpc::reflection::InitProtoReflectionServerBuilderPlugin();
       ServerBuilder builder;
       // Listen on the given address without any authentication mechanism.
       builder.AddListeningPort(binding, grpc::InsecureServerCredentials());
+      builder.SetMaxReceiveMessageSize(max_message_size);
       builder.RegisterService(&service);
+      std::vector<std::unique_ptr<ServerCompletionQueue>> cqs;
+      for (int i = 0; i < num_cqs; ++i) {
+        cqs.emplace_back(builder.AddCompletionQueue());
+      }
        // Finally assemble the server.
       std::unique_ptr<Server> server(builder.BuildAndStart());
-      rpc_log->info("Server listening on {}",binding);
-
+      rpc_log->info("Server listening on {} with {} completion queues and {} "
+                    "polling threads", binding, num_cqs, num_threads);
+      // each queue starts with one pending call per method, a call spawns its
+      // successor as soon as a client arrives
+      for (auto& cq : cqs) {
+        new detection_call<detection_output>(&service, cq.get(), taskq);
+        new detection_call<packed_detection_output>(&service, cq.get(), taskq);
+        new batch_call(&service, cq.get(), taskq, max_batch_images);
+        new stream_call(&service, cq.get(), taskq, max_stream_frames);
+      }
+      std::vector<std::thread> pollers;
+      pollers.reserve(num_threads);
+      for (int i = 0; i < num_threads; ++i) {
+        pollers.emplace_back(poll, cqs[i % num_cqs].get());
+      }
       // Wait for the server to shutdown. Note that some other thread must be
       // responsible for shutting down the server for this call to ever return.
       server->Wait();
+      for (auto& cq : cqs) {
+        cq->Shutdown();
+      }
+      for (auto& t : pollers) {
+        t.join();
+      }
   }
 }; // class grpc_listen_worker
 } // namespace rpc
@@ -0,0 +1,190 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the parsing of the body of the batch requests,
+ * multipart/mixed or length-prefixed images
+ ***************************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "st_utils.h"
+
+namespace st {
+namespace worker {
+
+/**
+ * @brief Content type of the length-prefixed batch body
+ * @details The body is a sequence of images, each one preceded by its size as
+ * a little-endian u32.
+ */
+constexpr char length_prefixed_batch[] = "application/x-st-batch";
+
+/**
+ * @brief One image of a batch request
+ * @details The part points into the body of the request, which must outlive
+ * it. The headers are the ones of the part for multipart bodies and are empty
+ * for length-prefixed bodies.
+ */
+struct batch_part {
+  const char* data = nullptr;
+  int size = 0;
+  std::vector<std::pair<beast::string_view, beast::string_view>> headers;
+  /**
+   * @brief Value of a header of the part, case insensitive
+   *
+   * @param name
+   * @return beast::string_view empty if the part has no such header
+   */
+  beast::string_view header(beast::string_view name) const {
+    for (const auto& h : headers) {
+      if (beast::iequals(h.first, name)) return h.second;
+    }
+    return {};
+  }
+};
+
+/**
+ * @brief Result of the split of a batch body
+ *
+ */
+enum class split_status {
+  OK,
+  MALFORMED,  //!< the body doesn't follow its content type, or an image is
+              //!< empty
+  TOO_LARGE   //!< well formed, with more than max_parts images
+};
+
+/**
+ * @brief Split a length-prefixed body
+ * @details The whole body is checked, so that a malformed body is reported
+ * as such whatever its number of images.
+ * @param body
+ * @param max_parts at most that many parts are appended
+ * @param parts where the parts are appended
+ * @return split_status
+ */
+inline split_status split_length_prefixed(beast::string_view body,
+                                          size_t max_parts,
+                                          std::vector<batch_part>& parts) {
+  const auto bytes = reinterpret_cast<const unsigned char*>(body.data());
+  size_t pos = 0;
+  size_t count = 0;
+  while (pos < body.size()) {
+    if (body.size() - pos < 4) return split_status::MALFORMED;
+    const std::uint32_t size =
+        bytes[pos] | (bytes[pos + 1] << 8) | (bytes[pos + 2] << 16) |
+        (static_cast<std::uint32_t>(bytes[pos + 3]) << 24);
+    pos += 4;
+    if (size == 0 || size > body.size() - pos ||
+        size > static_cast<std::uint32_t>(std::numeric_limits<int>::max())) {
+      return split_status::MALFORMED;
+    }
+    if (++count <= max_parts) {
+      batch_part part;
+      part.data = body.data() + pos;
+      part.size = static_cast<int>(size);
+      parts.push_back(std::move(part));
+    }
+    pos += size;
+  }
+  return count > max_parts ? split_status::TOO_LARGE : split_status::OK;
+}
+
+/**
+ * @brief Read the boundary parameter of a multipart content type
+ *
+ * @param content_type
+ * @return std::string empty if there is no boundary
+ */
+inline std::string multipart_boundary(beast::string_view content_type) {
+  const auto semicolon = content_type.find(';');
+  if (semicolon == beast::string_view::npos) return "";
+  for (auto const& param : http::param_list(content_type.substr(semicolon))) {
+    if (beast::iequals(param.first, "boundary")) {
+      // a quoted value is unquoted in a buffer of the iterator, copy it
+      return static_cast<std::string>(param.second);
+    }
+  }
+  return "";
+}
+
+/**
+ * @brief Split a multipart body (RFC 2046)
+ * @details The preamble and the epilogue are ignored. The headers of each
+ * part are kept, the body of the part is the image. The whole body is
+ * checked, so that a malformed body is reported as such whatever its number
+ * of parts.
+ * @param body
+ * @param boundary
+ * @param max_parts at most that many parts are appended
+ * @param parts where the parts are appended
+ * @return split_status
+ */
+inline split_status split_multipart(beast::string_view body,
+                                    beast::string_view boundary,
+                                    size_t max_parts,
+                                    std::vector<batch_part>& parts) {
+  const split_status malformed = split_status::MALFORMED;
+  if (boundary.empty()) return malformed;
+  auto is_blank = [](char c) { return c == ' ' || c == '\t'; };
+  const std::string delimiter = "\r\n--" + static_cast<std::string>(boundary);
+  // the first delimiter may start the body, without the leading CRLF
+  size_t pos = 0;
+  if (body.substr(0, delimiter.size() - 2) ==
+      beast::string_view(delimiter).substr(2)) {
+    pos = delimiter.size() - 2;
+  } else {
+    pos = body.find(delimiter);
+    if (pos == beast::string_view::npos) return malformed;
+    pos += delimiter.size();
+  }
+  size_t count = 0;
+  for (;;) {
+    // close delimiter, the rest is the epilogue
+    if (body.substr(pos, 2) == "--") {
+      return count > max_parts ? split_status::TOO_LARGE : split_status::OK;
+    }
+    // transport padding, then the CRLF that ends the delimiter line
+    while (pos < body.size() && is_blank(body[pos])) ++pos;
+    if (body.substr(pos, 2) != "\r\n") return malformed;
+    pos += 2;
+    const size_t end = body.find(delimiter, pos);
+    if (end == beast::string_view::npos) return malformed;
+    batch_part part;
+    // header lines up to an empty line
+    for (;;) {
+      const size_t eol = body.find("\r\n", pos);
+      // the CRLF of the delimiter is not the empty line of the headers
+      if (eol == beast::string_view::npos || eol >= end) return malformed;
+      if (eol == pos) {
+        pos += 2;
+        break;
+      }
+      const auto line = body.substr(pos, eol - pos);
+      const size_t colon = line.find(':');
+      if (colon == beast::string_view::npos) return malformed;
+      auto value = line.substr(colon + 1);
+      while (!value.empty() && is_blank(value.front())) value.remove_prefix(1);
+      while (!value.empty() && is_blank(value.back())) value.remove_suffix(1);
+      part.headers.emplace_back(line.substr(0, colon), value);
+      pos = eol + 2;
+    }
+    if (end <= pos ||
+        end - pos > static_cast<size_t>(std::numeric_limits<int>::max())) {
+      return malformed;
+    }
+    part.data = body.data() + pos;
+    part.size = static_cast<int>(end - pos);
+    if (++count <= max_parts) parts.push_back(std::move(part));
+    pos = end + delimiter.size();
+  }
+}
+
+}  // namespace worker
+}  // namespace st
@@ -10,12 +10,14 @@
 
 #pragma once
 #include <fstream>
+#include <functional>
 #include <sstream>
 #include <iterator>
 #include <memory>
 #include <string>
 #include <vector>
-#include "st_ie_common.h"
+#include "st_ie_types.h"
+#include "st_ie_postprocess.h"
 
 /*
 TensorRT and OpenVINO Anatomy
@@ -68,9 +70,55 @@ class inference_engine {
    *
    * @param data
    * @param size
-   * @return std::vector<bbox>
+   * @param result where the prediction is written, its previous boxes are
+   * cleared
+   * @param params options of the request
    */
-  virtual std::vector<bbox> run_detection(const char* data, int size) = 0;
+  virtual void run_detection(
+      const char* data, int size, detection_result& result,
+      const inference_params& params = inference_params()) = 0;
+
+  /**
+   * @brief Run object detection and classification on a batch of images
+   * @details The default implementation runs the images one by one, engines
+   * that can execute a batch at once should override it
+   * @param data encoded images
+   * @param size size of each encoded image
+   * @param params options of each request
+   * @param results where the prediction of each image is written
+   */
+  virtual void run_detection_batch(
+      const std::vector<const char*>& data, const std::vector<int>& size,
+      const std::vector<inference_params>& params,
+      const std::vector<detection_result*>& results) {
+    for (size_t i = 0; i < data.size(); ++i) {
+      run_detection(data[i], size[i], *results[i], params[i]);
+    }
+  }
+
+  /**
+   * @brief Run object detection and classification without blocking on the
+   * inference
+   * @details The default implementation runs the detection synchronously and
+   * calls done before returning. Engines that can keep several inference
+   * requests in flight should override it and call done from their
+   * completion callback. The call may still block when all requests of the
+   * engine are busy. An engine that throws must not call done, the caller
+   * answers the request.
+   * @param data encoded image
+   * @param size size of the encoded image
+   * @param params options of the request
+   * @param predictions where the prediction is written, must be valid until
+   * done is called
+   * @param done called once predictions is ready
+   */
+  virtual void run_detection_async(const char* data, int size,
+                                   const inference_params& params,
+                                   detection_result* predictions,
+                                   std::function<void()> done) {
+    run_detection(data, size, *predictions, params);
+    done();
+  }
 
   /**
    * @brief default shared pointer
@@ -79,7 +127,7 @@ class inference_engine {
   using ptr = std::shared_ptr<inference_engine>;
 
  protected:
-  std::vector<std::string> labels;
+  label_table::ptr labels;  //!< shared by the replicas of the model
   /**
    * @brief Construct a new inference engine object
    *
@@ -90,19 +138,39 @@ class inference_engine {
    *
    */
   virtual ~inference_engine(){};
+  /**
+   * @brief Clear a result before the engine writes to it
+   *
+   * @param result
+   */
+  void reset_result(detection_result& result) const {
+    result.clear();
+    result.labels = labels;
+  }
+  /**
+   * @brief Append the boxes of a DetectionOutput layer to a result
+   *
+   * @param boxes
+   * @param result
+   */
+  void append_boxes(const detection_columns& boxes,
+                    detection_result& result) const {
+    for (size_t i = 0; i < boxes.size(); ++i) {
+      const bbox d = {boxes.label_id[i], boxes.confidence[i],
+                      {static_cast<float>(boxes.x0[i]),
+                       static_cast<float>(boxes.y0[i]),
+                       static_cast<float>(boxes.x1[i]),
+                       static_cast<float>(boxes.y1[i])}};
+      result.boxes.push_back(d);
+    }
+  }
   /**
    * @brief Set the labels object
    *
    * @param label
    */
   void set_labels(const std::string& label) {
-    std::ifstream inputFile(label);
-    std::stringstream ss;
-    ss << inputFile.rdbuf();
-    std::string tmp;
-    while (std::getline(ss, tmp, '\n')) {
-      labels.push_back(tmp);
-    }
+    labels = label_table::load(label);
   }
 }; // class inference_engine
 }  // namespace st
@@ -15,6 +15,7 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include "st_ie_preprocess.h"
 #include "st_logging.h"
 
 using namespace nvinfer1;
@@ -87,6 +88,20 @@ struct gpu_deleter {
   void operator()(void* data) { cudaFree(data); }
 };
 
+/**
+ * @brief Element type written by the preprocessing kernels for a buffer type
+ *
+ * @tparam T
+ */
+template <typename T>
+struct preprocess_type {
+  using type = T;
+};
+template <>
+struct preprocess_type<half> {
+  using type = fp16_t;
+};
+
 /**
 * @brief RAII generic buffer implementation
 * @tparam Allocator
@@ -116,30 +131,19 @@ public:
     // default NCHW
     size_t channels = dim.d[2], height = dim.d[0],
         width = dim.d[1];
-    // assert(batch_size == 1);
-    // assert(size == batch_size * channels * height * width);
-    // resize the mat data to chw
-    cv::Mat resized_image(orig_image);
     trt_log->debug("Input image channels: {}", channels);
     trt_log->debug("Resize image height {}->{}", orig_image.size().height, height);
     trt_log->debug("Resize image width {}->{}", orig_image.size().width, width);
-    if (static_cast<int>(height) != orig_image.size().height ||
-        static_cast<int>(width) != orig_image.size().width) {
-      cv::resize(orig_image, resized_image, cv::Size(width, height));
+    if (channels != 3) {
+      throw std::logic_error("Expected 3 input channels, got " +
+                             std::to_string(channels));
     }
-    // 3 channel, nhwc
-    // fill the buffer in order C->H->W
+    // 3 channel, nhwc, normalized to [-1, 1]
     size_t batch_offset = batch_id * channels * height * width;
-    auto typed_data = (value_type*) data;
-      for (size_t h = 0; h < height; ++h) {
-        for (size_t w = 0; w < width; ++w) {
-          for (size_t c = 0; c < channels; ++c) {
-          size_t offset = batch_offset + h * width * channels + w * channels;
-          typed_data[offset + c] = 
-              (2.0 / 255.0) * value_type(resized_image.at<cv::Vec3b>(h, w)[c]) - 1.0;
-        }
-      }
-    }
+    auto typed_data =
+        reinterpret_cast<typename preprocess_type<value_type>::type*>(data);
+    resize_convert(orig_image, width, height, typed_data + batch_offset,
+                   pixel_layout::HWC, {2.0f / 255.0f, -1.0f});
     trt_log->debug("Fill buffer with data");
     return;
   }
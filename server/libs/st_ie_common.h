@@ -8,47 +8,22 @@
 
 #include <NvInfer.h>
 #include <cuda_runtime_api.h>
+#include <algorithm>
 #include <inference_engine.hpp>
+#include <map>
 #include <memory>
 #include <opencv2/opencv.hpp>
 #include <string>
 #include <vector>
-#include "st_message_queue.h"
+#include "st_ie_decode.h"
+#include "st_ie_preprocess.h"
+#include "st_ie_types.h"
 
 using namespace InferenceEngine;
 using namespace nvinfer1;
 
 namespace st {
 namespace ie {
-/**
- * @brief Bouding box object
- * @details Basic bouding box object that can use in any recognition task
- */
-struct bbox {
-  int label_id;             //!< label id
-  std::string label;        //!< class name
-  float prop;               //!< confidence score
-  int c[4] = {};            //!< coordinates of bounding box
-};
-
-/**
- * @brief Message template that can hold object detection result
- *
- * @tparam simple_bell
- */
-template <class simple_bell>
-using obj_detection_msg =
-    st::sync::message<const char*, int, std::vector<bbox>*, simple_bell>;
-
-/**
- * @brief Object detection message queue that can be used to exchange object
- * detection message
- *
- * @tparam simple_bell
- */
-template <class simple_bell>
-using object_detection_mq =  st::sync::blocking_queue<obj_detection_msg<simple_bell>>;
-
 /**
 * @brief Sets image data stored in cv::Mat object to a given Blob object.
 * @param orig_image - given cv::Mat object with an image data.
@@ -65,14 +40,20 @@ void matU8ToBlob(const cv::Mat& orig_image, Blob::Ptr& blob,
   // std::cout << width << " - " << height << std::endl;
   T* blob_data = blob->buffer().as<T*>();
 
+  int batchOffset = batchIndex * width * height * channels;
+  if (channels == 3) {
+    // fused resize and deinterleave, straight into the blob
+    resize_convert(orig_image, width, height, blob_data + batchOffset,
+                   pixel_layout::CHW);
+    return;
+  }
+
   cv::Mat resized_image(orig_image);
   if (static_cast<int>(width) != orig_image.size().width ||
       static_cast<int>(height) != orig_image.size().height) {
     cv::resize(orig_image, resized_image, cv::Size(width, height));
   }
 
-  int batchOffset = batchIndex * width * height * channels;
-
   for (size_t c = 0; c < channels; c++) {
     for (size_t h = 0; h < height; h++) {
       for (size_t w = 0; w < width; w++) {
@@ -102,6 +83,8 @@ struct network_output {
   InferRequest::Ptr infer_request;
   int width;
   int height;
+  int batch_id;  //!< index of the image in the batch of the request
+  inference_params params;  //!< options of the request of the image
 };
 
 static std::vector<std::pair<std::string,InferenceEngineProfileInfo>>
@@ -0,0 +1,210 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the decoding of the input images, encoded
+ * images or raw frames
+ ***************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "st_ie_types.h"
+
+namespace st {
+namespace ie {
+
+/**
+ * @brief Read the dimensions of a JPEG image from its frame header
+ * @details Walks the marker segments up to the first SOFn, nothing is
+ * decoded.
+ * @param data encoded image
+ * @param size size of the encoded image
+ * @param width width of the image, set on success
+ * @param height height of the image, set on success
+ * @return true if data is a JPEG image with a valid frame header
+ */
+inline bool jpeg_dimensions(const unsigned char* data, size_t size, int* width,
+                            int* height) {
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+  size_t pos = 2;
+  while (pos + 2 <= size) {
+    if (data[pos] != 0xFF) return false;
+    const unsigned char marker = data[pos + 1];
+    if (marker == 0xFF) {  // fill byte
+      ++pos;
+      continue;
+    }
+    pos += 2;
+    // standalone markers, no length
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+    // end of image or start of scan before any frame header
+    if (marker == 0xD9 || marker == 0xDA) return false;
+    if (pos + 2 > size) return false;
+    const size_t length = (data[pos] << 8) | data[pos + 1];
+    if (length < 2) return false;
+    // SOF0 to SOF15, except DHT, JPG and DAC which share the range
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC) {
+      if (length < 7 || pos + 7 > size) return false;
+      *height = (data[pos + 3] << 8) | data[pos + 4];
+      *width = (data[pos + 5] << 8) | data[pos + 6];
+      return *width > 0 && *height > 0;
+    }
+    pos += length;
+  }
+  return false;
+}
+
+/**
+ * @brief Largest DCT scaling denominator (1, 2, 4 or 8) that keeps the image
+ * at least as large as the given size
+ *
+ * @param width width of the image
+ * @param height height of the image
+ * @param min_width
+ * @param min_height
+ * @return int
+ */
+inline int jpeg_reduction(int width, int height, int min_width,
+                          int min_height) {
+  int scale = 1;
+  for (int s = 2; s <= 8; s *= 2) {
+    // libjpeg rounds the scaled dimensions up
+    if ((width + s - 1) / s < min_width || (height + s - 1) / s < min_height) {
+      break;
+    }
+    scale = s;
+  }
+  return scale;
+}
+
+/**
+ * @brief Decode an image, at a reduced resolution when it is a JPEG image much
+ * larger than needed
+ * @details A JPEG image at least twice as large as min_width x min_height is
+ * decoded with IMREAD_REDUCED_COLOR_2, _4 or _8, which scales it down in the
+ * DCT domain and saves most of the decoding time and memory. Other images are
+ * decoded at full resolution. The image is always 8-bit: a 16-bit PNG or
+ * TIFF is scaled down to 8 bits, the engines only take 8-bit input.
+ * @param data encoded image
+ * @param size size of the encoded image
+ * @param min_width smallest width of the decoded image, 0 for full resolution
+ * @param min_height smallest height of the decoded image, 0 for full resolution
+ * @param original size of the image before the reduction
+ * @return cv::Mat decoded image, throw cv::Exception on failure
+ */
+inline cv::Mat decode_image(const char* data, int size, int min_width,
+                            int min_height, cv::Size* original) {
+  const auto bytes = reinterpret_cast<const unsigned char*>(data);
+  // 8-bit, gray or color like the encoded image, EXIF orientation ignored
+  const int full = cv::IMREAD_ANYCOLOR | cv::IMREAD_IGNORE_ORIENTATION;
+  int flags = full;
+  int width = 0, height = 0;
+  if (min_width > 0 && min_height > 0 && size > 0 &&
+      jpeg_dimensions(bytes, size, &width, &height)) {
+    // the reduced modes are color modes, keep ignoring the EXIF orientation
+    // so that the header dimensions stay right
+    switch (jpeg_reduction(width, height, min_width, min_height)) {
+      case 8:
+        flags = cv::IMREAD_REDUCED_COLOR_8 | cv::IMREAD_IGNORE_ORIENTATION;
+        break;
+      case 4:
+        flags = cv::IMREAD_REDUCED_COLOR_4 | cv::IMREAD_IGNORE_ORIENTATION;
+        break;
+      case 2:
+        flags = cv::IMREAD_REDUCED_COLOR_2 | cv::IMREAD_IGNORE_ORIENTATION;
+        break;
+      default:
+        break;
+    }
+  }
+  cv::Mat frame = cv::imdecode(
+      cv::Mat(1, size, CV_8UC1, const_cast<unsigned char*>(bytes)), flags);
+  if (original != nullptr) {
+    *original = (flags == full || frame.empty())
+                    ? frame.size()
+                    : cv::Size(width, height);
+  }
+  return frame;
+}
+
+/**
+ * @brief Read a pixel format from its name
+ *
+ * @param name bgr, rgb or nv12, case insensitive
+ * @param format set on success
+ * @return true if the name is known
+ */
+inline bool parse_pixel_format(const std::string& name, pixel_format* format) {
+  static const struct {
+    const char* name;
+    pixel_format format;
+  } formats[] = {{"bgr", pixel_format::BGR},
+                 {"rgb", pixel_format::RGB},
+                 {"nv12", pixel_format::NV12}};
+  for (const auto& f : formats) {
+    if (name.size() == std::strlen(f.name) &&
+        std::equal(name.begin(), name.end(), f.name, [](char a, char b) {
+          return std::tolower(static_cast<unsigned char>(a)) == b;
+        })) {
+      *format = f.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Get the BGR image of a request, encoded images are decoded with
+ * decode_image and raw frames are used as they are
+ * @details A BGR frame is wrapped without any copy, the image points into
+ * data and is only valid as long as data is. RGB and NV12 frames are
+ * converted to BGR in one pass.
+ * @param data encoded image or raw frame
+ * @param size size of the data
+ * @param format format of the data
+ * @param min_width see decode_image, ignored for raw frames
+ * @param min_height see decode_image, ignored for raw frames
+ * @param original size of the image
+ * @return cv::Mat image, empty if the raw frame doesn't match its format,
+ * throw cv::Exception if an encoded image cannot be decoded
+ */
+inline cv::Mat load_image(const char* data, int size,
+                          const image_format& format, int min_width,
+                          int min_height, cv::Size* original) {
+  if (!format.raw()) {
+    return decode_image(data, size, min_width, min_height, original);
+  }
+  cv::Mat frame;
+  if (size >= 0 && format.valid(size)) {
+    auto bytes = reinterpret_cast<unsigned char*>(const_cast<char*>(data));
+    switch (format.format) {
+      case pixel_format::BGR:
+        frame = cv::Mat(format.height, format.width, CV_8UC3, bytes,
+                        format.row_bytes());
+        break;
+      case pixel_format::RGB:
+        cv::cvtColor(cv::Mat(format.height, format.width, CV_8UC3, bytes,
+                             format.row_bytes()),
+                     frame, cv::COLOR_RGB2BGR);
+        break;
+      case pixel_format::NV12:
+        cv::cvtColor(cv::Mat(format.height * 3 / 2, format.width, CV_8UC1,
+                             bytes, format.row_bytes()),
+                     frame, cv::COLOR_YUV2BGR_NV12);
+        break;
+      default:
+        break;
+    }
+  }
+  if (original != nullptr) *original = frame.size();
+  return frame;
+}
+
+}  // namespace ie
+}  // namespace st
@@ -8,6 +8,7 @@
 #include <string>
 #include <unordered_map>
 #include "st_ie_base.h"
+#include "st_ie_mock.h"
 #include "st_ie_openvino.h"
 #include "st_ie_tensorrt.h"
 #include "st_utils.h"
@@ -44,30 +45,68 @@ model_code str2mcode(const std::string& model_name) {
   }
 }
 
+// convert string to preprocessing mode of openvino engines
+preprocess_mode str2pmode(const std::string& mode_name) {
+  std::string mode;
+  std::transform(mode_name.begin(), mode_name.end(),
+                 std::back_inserter(mode),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (mode == "host") {
+    return preprocess_mode::HOST;
+  } else if (mode == "plugin") {
+    return preprocess_mode::PLUGIN;
+  } else {
+    throw std::logic_error("Preprocessing mode [" + mode_name +
+                           "] has not yet implemented");
+  }
+}
+
+// read the output options of the classification network
+classification_params read_classification_params(JSON& model) {
+  classification_params ret;
+  ret.top_k = model.get<int>("top k", ret.top_k);
+  ret.min_confidence = model.get<float>("min confidence", ret.min_confidence);
+  ret.softmax = model.get<bool>("softmax", ret.softmax);
+  ret.temperature = model.get<float>("temperature", ret.temperature);
+  return ret;
+}
+
 // create openvino inference engine
 inference_engine::ptr create_openvino_engine(const std::string& plugin,
                                              const std::string& model_name,
                                              const std::string& model,
                                              const std::string& label,
-                                             JSON dev_map = {}) {
+                                             JSON dev_map = {},
+                                             int max_batch = 1,
+                                             int max_requests = 1,
+                                             int streams = 1,
+                                             preprocess_mode mode =
+                                                 preprocess_mode::HOST,
+                                             classification_params cls =
+                                                 classification_params()) {
   auto type = str2mcode(model_name);
   openvino_inference_engine::ptr ret;
   switch (type) {
     case model_code::SSD:
-      ret = std::make_shared<openvino_ssd>(plugin, model, label);
+      ret = std::make_shared<openvino_ssd>(plugin, model, label, max_batch,
+                                           max_requests, mode);
       break;
     case model_code::YOLOV3:
-      ret = std::make_shared<openvino_yolo>(plugin, model, label);
+      ret = std::make_shared<openvino_yolo>(plugin, model, label, max_batch,
+                                            max_requests, mode);
       break;
     case model_code::RCNN:
-      ret = std::make_shared<openvino_frcnn>(plugin, model, label);
+      ret = std::make_shared<openvino_frcnn>(plugin, model, label, max_batch,
+                                             max_requests, mode);
       break;
     case model_code::CLS:
-      ret = std::make_shared<openvino_anynet_classification>(plugin, model, label);
+      ret = std::make_shared<openvino_anynet_classification>(
+          plugin, model, label, max_batch, max_requests, mode, cls);
       break;
     default:
       return nullptr;
   }
+  ret->set_throughput_streams(streams);
   ret->load_fallback_policy(dev_map);
   return ret;
 }
@@ -116,7 +155,14 @@ class intel_cpu_inference_engine_creator : public inference_engine_creator {
     const std::string& name = model.get<std::string>("name");
     const std::string& graph = model.get<std::string>("graph");
     const std::string& label = model.get<std::string>("label");
-    return create_openvino_engine(plugin, name, graph, label, {});
+    const int max_batch = conf.get<int>("max batch", 1);
+    const int max_requests = conf.get<int>("infer requests", 1);
+    // replicas share one executable network, one stream per request
+    const int streams = conf.get<int>("replicas", 1) * max_requests;
+    const auto mode = str2pmode(model.get<std::string>("preprocess", "host"));
+    const auto cls = read_classification_params(model);
+    return create_openvino_engine(plugin, name, graph, label, {}, max_batch,
+                                  max_requests, streams, mode, cls);
   }
 };
 /**
@@ -132,12 +178,18 @@ class intel_fpga_inference_engine_creator : public inference_engine_creator {
     const std::string& name = model.get<std::string>("name");
     const std::string& graph = model.get<std::string>("graph");
     const std::string& label = model.get<std::string>("label");
+    const int max_batch = conf.get<int>("max batch", 1);
+    const int max_requests = conf.get<int>("infer requests", 1);
+    const auto mode = str2pmode(model.get<std::string>("preprocess", "host"));
+    const auto cls = read_classification_params(model);
     if (model.find("fallback") == model.not_found()) {
-      return create_openvino_engine(plugin, name, graph, label);
+      return create_openvino_engine(plugin, name, graph, label, {}, max_batch,
+                                    max_requests, 1, mode, cls);
     }
     else {
       JSON &dev_map = model.get_child("fallback");
-      return create_openvino_engine(plugin, name, graph, label, dev_map);
+      return create_openvino_engine(plugin, name, graph, label, dev_map,
+                                    max_batch, max_requests, 1, mode, cls);
     }
   }
 };
@@ -167,6 +219,21 @@ class xilinx_fpga_inference_engine_creator : public inference_engine_creator {
   }
 };
 
+/**
+ * @brief Creator for the mock engine, which only waits
+ *
+ */
+class mock_inference_engine_creator : public inference_engine_creator {
+ public:
+  inference_engine::ptr create(JSON& conf) final {
+    auto& model = conf.get_child("model");
+    const std::string label = model.get<std::string>("label", "");
+    return std::make_shared<mock_inference_engine>(
+        conf.get<int>("latency us", 1000),
+        conf.get<int>("latency us per mb", 0), label);
+  }
+};
+
 /**
  * @brief Factory class to create different type of inference engine
  *
@@ -179,6 +246,7 @@ class ie_factory {
     Register("intel cpu", new intel_cpu_inference_engine_creator());
     Register("intel fpga", new intel_fpga_inference_engine_creator());
     Register("nvidia gpu", new nvidia_gpu_inference_engine_creator());
+    Register("mock", new mock_inference_engine_creator());
   }
   /**
    * @brief Create a inference engine object
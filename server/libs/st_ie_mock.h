@@ -0,0 +1,64 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement a mock inference engine with a configured
+ * latency, to run the server and its scheduler without accelerator
+ ***************************************************************************************/
+
+#pragma once
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "st_ie_base.h"
+
+namespace st {
+namespace ie {
+
+/**
+ * @brief Inference engine that only waits
+ * @details The service time of an image is latency_us plus latency_us_per_mb
+ * times the size of the image in MB. The image is not decoded and the
+ * prediction has no box. Several mock engines with different latencies stand
+ * for a mix of devices, e.g. to check where the scheduler sends the requests.
+ */
+class mock_inference_engine : public inference_engine {
+ public:
+  /**
+   * @brief Construct a new mock inference engine object
+   *
+   * @param _latency_us fixed part of the service time
+   * @param _latency_us_per_mb part of the service time proportional to the
+   * size of the image
+   * @param label label file, may be empty
+   */
+  mock_inference_engine(int _latency_us, int _latency_us_per_mb,
+                        const std::string& label = "")
+      : latency_us(_latency_us), latency_us_per_mb(_latency_us_per_mb) {
+    set_labels(label);
+  }
+  void run_detection(const char* data, int size, detection_result& result,
+                     const inference_params& params) final {
+    reset_result(result);
+    std::this_thread::sleep_for(service_time(size));
+  }
+  /**
+   * @brief Service time of an image
+   *
+   * @param size of the image in bytes
+   * @return std::chrono::microseconds
+   */
+  std::chrono::microseconds service_time(int size) const {
+    const long long per_size =
+        static_cast<long long>(latency_us_per_mb) * size / (1 << 20);
+    return std::chrono::microseconds(latency_us + per_size);
+  }
+  using ptr = std::shared_ptr<mock_inference_engine>;
+
+ private:
+  int latency_us;
+  int latency_us_per_mb;
+};
+
+}  // namespace ie
+}  // namespace st
@@ -0,0 +1,251 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the non-maximum suppression of detected boxes
+ ***************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include "st_ie_postprocess.h"
+
+namespace st {
+namespace ie {
+
+/**
+ * @brief Parameters of the non-maximum suppression
+ *
+ */
+struct nms_params {
+  float iou_threshold = 0.45f;  //!< suppress boxes overlapping a kept box more
+  int top_k = -1;       //!< candidates per class, best scores first, -1 for all
+  int keep_top_k = -1;  //!< kept boxes per class, -1 for all
+  int grid_size = 0;    //!< cells per side of the spatial grid, 0 to disable
+  bool soft = false;    //!< gaussian soft-NMS instead of suppression
+  float sigma = 0.5f;   //!< soft-NMS, score *= exp(-iou^2 / sigma)
+  float score_threshold = 0.001f;  //!< soft-NMS, drop boxes decayed below it
+};
+
+/**
+ * @brief Per-class non-maximum suppression
+ * @details Candidates are added one by one, then run() suppresses them class
+ * by class, best score first. The boxes kept so far are stored one array per
+ * coordinate and a candidate is compared with all of them at once with
+ * iou_any_above. With nms_params::grid_size, the kept boxes are also binned
+ * into a grid over the candidates of the class, and a candidate is only
+ * compared with the boxes of the cells it overlaps, which pays off for large
+ * images with many small objects. The object keeps its buffers between runs,
+ * it is meant to be reused (e.g. one per thread).
+ */
+class box_nms {
+ public:
+  void clear() {
+    boxes.clear();
+    scores.clear();
+    classes.clear();
+  }
+  void reserve(size_t n) {
+    boxes.reserve(n);
+    scores.reserve(n);
+    classes.reserve(n);
+  }
+  /**
+   * @brief Add a candidate
+   *
+   * @param x0 left
+   * @param y0 top
+   * @param x1 right
+   * @param y1 bottom
+   * @param score
+   * @param class_id
+   * @return int index of the candidate
+   */
+  int add(float x0, float y0, float x1, float y1, float score, int class_id) {
+    boxes.push_back({x0, y0, x1, y1, (x1 - x0) * (y1 - y0)});
+    scores.push_back(score);
+    classes.push_back(class_id);
+    return static_cast<int>(scores.size()) - 1;
+  }
+  size_t size() const { return scores.size(); }
+  /**
+   * @brief Score of a candidate, decayed by run() with soft-NMS
+   *
+   * @param i index of the candidate
+   * @return float
+   */
+  float score(int i) const { return scores[i]; }
+  int class_id(int i) const { return classes[i]; }
+  /**
+   * @brief Run the suppression
+   *
+   * @param params
+   * @return const std::vector<int>& indices of the kept candidates, by
+   * increasing class id then decreasing score
+   */
+  const std::vector<int>& run(const nms_params& params) {
+    kept.clear();
+    order.resize(scores.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+      if (classes[a] != classes[b]) return classes[a] < classes[b];
+      if (scores[a] != scores[b]) return scores[a] > scores[b];
+      return a < b;
+    });
+    for (size_t first = 0; first < order.size();) {
+      size_t last = first;
+      const int class_id = classes[order[first]];
+      while (last < order.size() && classes[order[last]] == class_id) ++last;
+      size_t end = last;
+      if (params.top_k >= 0 && first + params.top_k < last) {
+        end = first + params.top_k;
+      }
+      if (params.soft) {
+        suppress_soft(first, end, params);
+      } else {
+        suppress(first, end, params);
+      }
+      first = last;
+    }
+    return kept;
+  }
+
+ private:
+  std::vector<area_box> boxes;  //!< candidates
+  std::vector<float> scores;
+  std::vector<int> classes;
+  std::vector<int> order;  //!< candidates by class then score
+  std::vector<int> kept;   //!< result of run
+  // scratch buffers of one class
+  box_columns kept_boxes;
+  std::vector<box_columns> cells;  //!< kept boxes binned in the grid
+  box_columns pending;             //!< soft-NMS, candidates left
+  std::vector<int> pending_ids;
+  std::vector<float> pending_scores;
+  std::vector<float> iou;
+  // grid over the candidates of the current class
+  int grid_size = 0;
+  float grid_x0 = 0, grid_y0 = 0;
+  float inv_cell_w = 0, inv_cell_h = 0;
+
+  // suppress the candidates order[first, last) of one class
+  void suppress(size_t first, size_t last, const nms_params& params) {
+    // below this, comparing with every kept box is cheaper than the grid
+    const size_t min_grid_boxes = 64;
+    const bool use_grid =
+        params.grid_size > 1 && last - first >= min_grid_boxes;
+    if (use_grid) {
+      init_grid(first, last, params.grid_size);
+    } else {
+      kept_boxes.clear();
+    }
+    int count = 0;
+    for (size_t k = first; k < last; ++k) {
+      if (params.keep_top_k >= 0 && count >= params.keep_top_k) break;
+      const int i = order[k];
+      const area_box& b = boxes[i];
+      if (use_grid) {
+        if (grid_any_above(b, params.iou_threshold)) continue;
+        grid_insert(b);
+      } else {
+        if (iou_any_above(kept_boxes, b, params.iou_threshold)) continue;
+        kept_boxes.push_back(b);
+      }
+      kept.push_back(i);
+      ++count;
+    }
+  }
+
+  // gaussian soft-NMS of the candidates order[first, last) of one class
+  void suppress_soft(size_t first, size_t last, const nms_params& params) {
+    pending.clear();
+    pending_ids.clear();
+    pending_scores.clear();
+    for (size_t k = first; k < last; ++k) {
+      pending.push_back(boxes[order[k]]);
+      pending_ids.push_back(order[k]);
+      pending_scores.push_back(scores[order[k]]);
+    }
+    int count = 0;
+    while (!pending_ids.empty()) {
+      if (params.keep_top_k >= 0 && count >= params.keep_top_k) break;
+      const size_t best =
+          std::max_element(pending_scores.begin(), pending_scores.end()) -
+          pending_scores.begin();
+      if (pending_scores[best] < params.score_threshold) break;
+      const int i = pending_ids[best];
+      const area_box b = pending.get(best);
+      scores[i] = pending_scores[best];
+      kept.push_back(i);
+      ++count;
+      pending.swap_remove(best);
+      pending_ids[best] = pending_ids.back();
+      pending_ids.pop_back();
+      pending_scores[best] = pending_scores.back();
+      pending_scores.pop_back();
+      // decay the others by their overlap with the kept box
+      iou.resize(pending.size());
+      iou_row(pending, b, iou.data());
+      for (size_t j = 0; j < iou.size(); ++j) {
+        pending_scores[j] *= std::exp(-iou[j] * iou[j] / params.sigma);
+      }
+    }
+  }
+
+  // size the grid to the extent of the candidates order[first, last)
+  void init_grid(size_t first, size_t last, int size) {
+    float x0 = boxes[order[first]].x0, y0 = boxes[order[first]].y0;
+    float x1 = boxes[order[first]].x1, y1 = boxes[order[first]].y1;
+    for (size_t k = first + 1; k < last; ++k) {
+      const area_box& b = boxes[order[k]];
+      x0 = std::min(x0, b.x0);
+      y0 = std::min(y0, b.y0);
+      x1 = std::max(x1, b.x1);
+      y1 = std::max(y1, b.y1);
+    }
+    grid_size = size;
+    grid_x0 = x0;
+    grid_y0 = y0;
+    inv_cell_w = x1 > x0 ? size / (x1 - x0) : 0.f;
+    inv_cell_h = y1 > y0 ? size / (y1 - y0) : 0.f;
+    const size_t num_cells = static_cast<size_t>(size) * size;
+    if (cells.size() < num_cells) cells.resize(num_cells);
+    for (size_t c = 0; c < num_cells; ++c) cells[c].clear();
+  }
+  int cell_of(float v, float origin, float inv_cell) const {
+    const int c = static_cast<int>((v - origin) * inv_cell);
+    return std::min(std::max(c, 0), grid_size - 1);
+  }
+  // a kept box is stored in every cell it overlaps, so two overlapping boxes
+  // always share at least one cell
+  void grid_insert(const area_box& b) {
+    const int cx0 = cell_of(b.x0, grid_x0, inv_cell_w);
+    const int cx1 = cell_of(b.x1, grid_x0, inv_cell_w);
+    const int cy0 = cell_of(b.y0, grid_y0, inv_cell_h);
+    const int cy1 = cell_of(b.y1, grid_y0, inv_cell_h);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+      for (int cx = cx0; cx <= cx1; ++cx) {
+        cells[cy * grid_size + cx].push_back(b);
+      }
+    }
+  }
+  bool grid_any_above(const area_box& b, float threshold) const {
+    const int cx0 = cell_of(b.x0, grid_x0, inv_cell_w);
+    const int cx1 = cell_of(b.x1, grid_x0, inv_cell_w);
+    const int cy0 = cell_of(b.y0, grid_y0, inv_cell_h);
+    const int cy1 = cell_of(b.y1, grid_y0, inv_cell_h);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+      for (int cx = cx0; cx <= cx1; ++cx) {
+        if (iou_any_above(cells[cy * grid_size + cx], b, threshold)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+};
+
+}  // namespace ie
+}  // namespace st
@@ -12,6 +12,11 @@
 #include <map>
 #include <numeric>
 #include <algorithm>
+#include <condition_variable>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <mutex>
 
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/spdlog.h>
@@ -22,6 +27,10 @@
 #include <ie_plugin.hpp>
 #include <hetero/hetero_plugin_config.hpp>
 #include "st_ie_base.h"
+#include "st_ie_common.h"
+#include "st_ie_decode.h"
+#include "st_ie_nms.h"
+#include "st_ie_postprocess.h"
 #include "st_logging.h"
 #include "st_utils.h"
 
@@ -40,6 +49,25 @@ public:
         std::cout << msg;
     }
 };
+/**
+ * @brief Inference request created once and reused for every inference
+ * @details The input blobs are allocated with the request and bound to it,
+ * filling them is the only work left before Infer
+ */
+struct infer_slot {
+  InferRequest::Ptr request;  //!< the inference request
+  Blob::Ptr image;            //!< image input blob
+  Blob::Ptr info;             //!< image info input blob, faster r-cnn only
+  cv::Mat frame;  //!< image bound to the request with preprocess_mode::PLUGIN
+};
+/**
+ * @brief Where the input image is resized and converted to the network layout
+ *
+ */
+enum class preprocess_mode {
+  HOST,   //!< resized and transposed by resize_convert before the inference
+  PLUGIN  //!< bound as is, resized inside the preprocessing graph of the plugin
+};
 /**
  * @brief OpenVino inference engine
  *
@@ -50,20 +78,103 @@ public:
   /*  Inference engine public interface implementation            */
   /****************************************************************/
 
-  std::vector<bbox> run_detection(const char* data, int size) final {
-    auto net_out = do_infer(data, size);
-    return detection_parser(net_out);
+  void run_detection(
+      const char* data, int size, detection_result& result,
+      const inference_params& params = inference_params()) final {
+    reset_result(result);
+    slot_lease lease(*this);
+    auto net_out = do_infer(slots[lease.index()], data, size, params.input);
+    net_out.params = params;
+    if (net_out.infer_request) detection_parser(net_out, result);
+  }
+
+  void run_detection_batch(
+      const std::vector<const char*>& data, const std::vector<int>& size,
+      const std::vector<inference_params>& params,
+      const std::vector<detection_result*>& results) final {
+    // split into chunks that fit the batch dimension of the network
+    for (size_t first = 0; first < data.size(); first += batch_size) {
+      const size_t last = std::min(data.size(), first + batch_size);
+      slot_lease lease(*this);
+      auto net_outs = do_infer_batch(slots[lease.index()], &data[first],
+                                     &size[first], &params[first],
+                                     last - first);
+      for (size_t i = 0; i < net_outs.size(); ++i) {
+        auto& net_out = net_outs[i];
+        detection_result& result = *results[first + i];
+        reset_result(result);
+        if (!net_out.infer_request) continue;
+        net_out.params = params[first + i];
+        detection_parser(net_out, result);
+      }
+    }
+  }
+
+  void run_detection_async(const char* data, int size,
+                           const inference_params& params,
+                           detection_result* predictions,
+                           std::function<void()> done) final {
+    if (slots.size() < 2) {
+      // nothing to overlap with, run synchronously
+      run_detection(data, size, *predictions, params);
+      return done();
+    }
+    reset_result(*predictions);
+    // decode on the caller thread while the other requests are running
+    cv::Size original;
+    cv::Mat frame = decode_image(data, size, params.input, &original);
+    if (frame.empty()) {
+      return done();
+    }
+    // wait for a free request, then start it and return
+    const size_t id = acquire_slot();
+    infer_slot& slot = slots[id];
+    const int width = original.width;
+    const int height = original.height;
+    try {
+      fill_input(slot, frame, 0);
+      if (batch_size > 1) {
+        slot.request->SetBatch(1);
+      }
+      // the callback is run by the plugin once the inference is done, the
+      // output is parsed there so that it overlaps with the next inference
+      slot.request->SetCompletionCallback(std::function<void()>(
+          [this, id, width, height, params, predictions, done]() mutable {
+            try {
+              network_output net_out{slots[id].request, width, height, 0,
+                                     params};
+              detection_parser(net_out, *predictions);
+            } catch (const std::exception& e) {
+              std::cerr << "Error: " << e.what() << std::endl;
+              predictions->clear();
+            }
+            // once released, the slot may be reused and this callback
+            // replaced, which destroys the captures: keep what is needed on
+            // the stack and touch no capture after the release
+            openvino_inference_engine* self = this;
+            const size_t slot_id = id;
+            std::function<void()> finish = std::move(done);
+            finish();
+            self->release_slot(slot_id);
+          }));
+      slot.request->StartAsync();
+    } catch (const std::exception& e) {
+      // the callback will never run, answer the requester here
+      std::cerr << "Error: " << e.what() << std::endl;
+      predictions->clear();
+      release_slot(id);
+      done();
+    }
   }
 
   /**
    * @brief Parse detection output of a inference request, network specific
    *
    * @param net_out
-   * @return std::vector<bbox>
+   * @param result where the boxes are appended
    */
-  virtual std::vector<bbox> detection_parser(network_output& net_out) {
-    return {};
-  }
+  virtual void detection_parser(network_output& net_out,
+                                detection_result& result) {}
 
   /**
    * @brief custom fallback policy for layer
@@ -71,18 +182,64 @@ public:
    * @param dev_map 
    */
   void load_fallback_policy(JSON& dev_map) {
-    for (auto &p : dev_map) {
-      std::string layer_name = p.first;
-      std::string device = p.second.data();
-      ovn_log->debug("Force layer {} to run on {}", layer_name, device);
-      network.getLayerByName(layer_name.c_str())->affinity = device;
+    std::lock_guard<std::mutex> lk(cache_mtx());
+    auto& shared = get_network_cache()[cache_key];
+    if (shared.loaded) {
+      // another replica has already loaded the network
+      ovn_log->info("Sharing executable network {}", cache_key);
+      exe_network = shared.exe_network;
+    } else {
+      for (auto &p : dev_map) {
+        std::string layer_name = p.first;
+        std::string device = p.second.data();
+        ovn_log->debug("Force layer {} to run on {}", layer_name, device);
+        network.getLayerByName(layer_name.c_str())->affinity = device;
+      }
+      load_plugin({});
+      shared.exe_network = exe_network;
+      shared.loaded = true;
     }
-    load_plugin({});
+    init_infer_slots(num_requests);
   }
 
+  /**
+   * @brief Set the number of CPU throughput streams of the executable network
+   * @details Must be called before load_fallback_policy. Replicas sharing the
+   * executable network run their requests on these streams, so it should be
+   * the total number of requests in flight over all replicas. Only the first
+   * replica that loads the network uses it.
+   * @param streams
+   */
+  void set_throughput_streams(int streams) { num_streams = streams; }
+
   using ptr = std::shared_ptr<openvino_inference_engine>;
 
 private:
+  /**
+   * @brief Network shared by all replicas of the same model on the same device
+   *
+   */
+  struct shared_network {
+    InferenceEngine::InferencePlugin plugin;
+    InferenceEngine::CNNNetwork network;
+    InferenceEngine::ExecutableNetwork exe_network;
+    bool inited = false;  //!< plugin and network are ready
+    bool loaded = false;  //!< exe_network is ready
+  };
+  using network_cache = std::map<std::string, shared_network>;
+  /**
+   * @brief Networks that have been loaded, keyed by device, model and batch
+   *
+   * @return network_cache&
+   */
+  static network_cache& get_network_cache() {
+    static network_cache cache;
+    return cache;
+  }
+  static std::mutex& cache_mtx() {
+    static std::mutex mtx;
+    return mtx;
+  }
   /**
    * @brief OpenVino Inference Plugin
    *
@@ -116,6 +273,85 @@ protected:
    * guarantee FCFS
    */
   InferenceEngine::ExecutableNetwork exe_network;
+  /**
+   * @brief Maximum batch size of the network
+   * @details Set by the constructor of each network before the model is
+   * loaded. When it is greater than 1, the executable network is created with
+   * dynamic batching so that a request can run any number of images up to
+   * this size.
+   */
+  int batch_size = 1;
+  /**
+   * @brief Pool of inference requests of the executable network
+   * @details Created by load_plugin, so that no blob is allocated in the hot
+   * path
+   */
+  std::vector<infer_slot> slots;
+  std::vector<size_t> free_slots;   //!< index of the idle slots
+  std::mutex slot_mtx;              //!< protect free_slots
+  std::condition_variable slot_cv;  //!< notified when a slot is released
+  /**
+   * @brief Number of inference requests in the pool
+   * @details Set by the constructor of each network before the model is
+   * loaded. With more than one request, run_detection_async keeps up to this
+   * many inference requests in flight.
+   */
+  int num_requests = 1;
+  int num_streams = 1;    //!< CPU throughput streams of exe_network
+  /**
+   * @brief Where the images are preprocessed
+   * @details Set by the constructor of each network before the model is
+   * loaded. With preprocess_mode::PLUGIN, the decoded image is bound to the
+   * request as an NHWC blob and the plugin resizes it, which only works with
+   * a batch size of 1.
+   */
+  preprocess_mode preprocess = preprocess_mode::HOST;
+  std::string device_name;  //!< device of the plugin
+  std::string cache_key;    //!< key of the network in the network cache
+  /**
+   * @brief Create the plugin and read the network, or take them from another
+   * replica of the same model on the same device
+   *
+   * @param device
+   * @param model
+   * @param p precision of the image input
+   * @param layout layout of the image input
+   */
+  void init_network(const std::string& device, const std::string& model,
+                    Precision p, InferenceEngine::Layout layout) {
+    device_name = device;
+    if (preprocess == preprocess_mode::PLUGIN && batch_size > 1) {
+      ovn_log->warn("Plugin preprocessing needs batch size 1, got {}",
+                    batch_size);
+      batch_size = 1;
+    }
+    cache_key = device + ":" + model + ":" + std::to_string(batch_size) +
+                (preprocess == preprocess_mode::PLUGIN ? ":plugin" : ":host");
+    std::lock_guard<std::mutex> lk(cache_mtx());
+    auto& shared = get_network_cache()[cache_key];
+    if (shared.inited) {
+      ovn_log->info("Sharing network {}", cache_key);
+      plugin = shared.plugin;
+      network = shared.network;
+      return;
+    }
+    init_plugin(device);
+    load_network(model);
+    init_IO(p, layout);
+    shared.plugin = plugin;
+    shared.network = network;
+    shared.inited = true;
+  }
+  /**
+   * @brief Cached network IO, filled by load_plugin
+   *
+   */
+  std::string image_input;                //!< name of the image input
+  std::string info_input;                 //!< name of the image info input
+  size_t input_width = 0;                 //!< width of the image input
+  size_t input_height = 0;                //!< height of the image input
+  size_t info_size = 0;                   //!< size of an image info entry
+  std::vector<std::string> output_names;  //!< names of the outputs
   /**
    * @brief Initilize the device plugin
    *
@@ -167,8 +403,8 @@ protected:
     bin += "bin";
     netReader.ReadWeights(bin);
     network = netReader.getNetwork();
-    ovn_log->info("Set batch size to 1");
-    network.setBatchSize(1);
+    ovn_log->info("Set batch size to {}", batch_size);
+    network.setBatchSize(batch_size);
     auto hetero = plugin.operator InferenceEngine::HeteroPluginPtr();
     if (hetero) {
       ovn_log->info("Hetero mode detected, loading custom fallback policy if specified");
@@ -188,8 +424,15 @@ protected:
     std::chrono::time_point<std::chrono::system_clock> end;
     std::chrono::duration<double, std::milli> elapsed_mil;
     start = std::chrono::system_clock::now();
+    if (batch_size > 1) {
+      extension[KEY_DYN_BATCH_ENABLED] = YES;
+    }
+    if (num_streams > 1 && device_name == "CPU") {
+      ovn_log->info("Set CPU throughput streams to {}", num_streams);
+      extension[KEY_CPU_THROUGHPUT_STREAMS] = std::to_string(num_streams);
+    }
     try {
-      exe_network = plugin.LoadNetwork(network, {});
+      exe_network = plugin.LoadNetwork(network, extension);
     } catch (const std::exception& e) {
       std::cout << e.what() << '\n';
       exit(1);
@@ -198,6 +441,153 @@ protected:
     elapsed_mil = end - start;
     ovn_log->info("Creating new executable network in {} ms", elapsed_mil.count());
   }
+  /**
+   * @brief Cache the network IO and create the inference requests
+   *
+   * @param num_requests number of inference requests in the pool
+   */
+  void init_infer_slots(int num_requests) {
+    auto input_info = exe_network.GetInputsInfo();
+    for (auto it = input_info.begin(); it != input_info.end(); it++) {
+      const auto& dims = it->second->getTensorDesc().getDims();
+      if (dims.size() == 4) {
+        image_input = it->first;
+        input_height = dims[2];
+        input_width = dims[3];
+      } else if (dims.size() == 2) {  // faster rcnn
+        info_input = it->first;
+        info_size = dims[1];
+      }
+    }
+    output_names.clear();
+    auto output_info = exe_network.GetOutputsInfo();
+    for (auto it = output_info.begin(); it != output_info.end(); it++) {
+      output_names.push_back(it->first);
+    }
+    slots.clear();
+    free_slots.clear();
+    for (int i = 0; i < num_requests; ++i) {
+      infer_slot slot;
+      slot.request = exe_network.CreateInferRequestPtr();
+      slot.image = slot.request->GetBlob(image_input);
+      if (!info_input.empty()) {
+        slot.info = slot.request->GetBlob(info_input);
+        // image info is the same for every image
+        float* p = slot.info->buffer()
+                       .as<PrecisionTrait<Precision::FP32>::value_type*>();
+        for (int k = 0; k < batch_size; ++k) {
+          p[k * info_size + 0] = static_cast<float>(input_height);
+          p[k * info_size + 1] = static_cast<float>(input_width);
+          p[k * info_size + 2] = 1.0;
+        }
+      }
+      slots.push_back(std::move(slot));
+      free_slots.push_back(i);
+    }
+    ovn_log->info("Created {} inference requests", num_requests);
+  }
+  /**
+   * @brief Take an idle slot from the pool, block until there is one
+   *
+   * @return size_t index of the slot
+   */
+  size_t acquire_slot() {
+    std::unique_lock<std::mutex> lk(slot_mtx);
+    slot_cv.wait(lk, [this]() { return !free_slots.empty(); });
+    const size_t id = free_slots.back();
+    free_slots.pop_back();
+    return id;
+  }
+  /**
+   * @brief Give a slot back to the pool
+   *
+   * @param id index of the slot
+   */
+  void release_slot(size_t id) {
+    std::unique_lock<std::mutex> lk(slot_mtx);
+    free_slots.push_back(id);
+    lk.unlock();
+    slot_cv.notify_one();
+  }
+  /**
+   * @brief Slot taken from the pool for a scope, given back when the scope
+   * exits, even by an exception
+   */
+  class slot_lease {
+   public:
+    explicit slot_lease(openvino_inference_engine& _engine)
+        : engine(_engine), id(_engine.acquire_slot()) {}
+    ~slot_lease() { engine.release_slot(id); }
+    slot_lease(const slot_lease&) = delete;
+    slot_lease& operator=(const slot_lease&) = delete;
+    size_t index() const { return id; }
+
+   private:
+    openvino_inference_engine& engine;
+    const size_t id;
+  };
+  /**
+   * @brief Decode an encoded image, or wrap a raw frame
+   * @details Large JPEG images are decoded at the smallest reduced resolution
+   * that is still larger than the network input.
+   * @param data
+   * @param size
+   * @param format format of the data
+   * @param original size of the encoded image, the detections are scaled to it
+   * @return cv::Mat empty if the image cannot be decoded
+   */
+  cv::Mat decode_image(const char* data, int size, const image_format& format,
+                       cv::Size* original) {
+    try {
+      return load_image(data, size, format, input_width, input_height,
+                        original);
+    } catch (const cv::Exception& e) {
+      // let not opencv silly exception terminate our program
+      std::cerr << "Error: " << e.what() << std::endl;
+      return cv::Mat();
+    }
+  }
+  /**
+   * @brief Fill the image input of a request with a decoded image
+   *
+   * @param slot
+   * @param frame decoded image
+   * @param batch_id index of the image in the batch
+   */
+  void fill_input(infer_slot& slot, const cv::Mat& frame, int batch_id) {
+    if (preprocess == preprocess_mode::PLUGIN) {
+      bind_image(slot, frame);
+    } else {
+      matU8ToBlob<uint8_t>(frame, slot.image, batch_id);
+    }
+  }
+  /**
+   * @brief Bind the memory of a decoded image to the image input of a request
+   * @details The image is wrapped in an NHWC blob of its own size without any
+   * copy, the plugin does the resize and the layout conversion. The slot keeps
+   * a reference to the image until it is reused. Images of another depth
+   * are converted to 8 bits first, see to_8bit.
+   * @param slot
+   * @param image decoded image
+   */
+  void bind_image(infer_slot& slot, const cv::Mat& image) {
+    // the frames come from the client, convert rather than refuse them
+    const cv::Mat frame = to_8bit(image);
+    if (frame.channels() == 1) {
+      cv::cvtColor(frame, slot.frame, cv::COLOR_GRAY2BGR);
+    } else if (frame.channels() == 4) {
+      cv::cvtColor(frame, slot.frame, cv::COLOR_BGRA2BGR);
+    } else if (!frame.isContinuous()) {
+      slot.frame = frame.clone();
+    } else {
+      slot.frame = frame;
+    }
+    const size_t rows = slot.frame.rows;
+    const size_t cols = slot.frame.cols;
+    TensorDesc desc(Precision::U8, {1, 3, rows, cols}, Layout::NHWC);
+    slot.request->SetBlob(image_input,
+                          make_shared_blob<uint8_t>(desc, slot.frame.data));
+  }
   /**
    * @brief Perform sanity check for a network
    * @details This function is virtual and should be overridden for each network
@@ -216,7 +606,14 @@ protected:
       if (item.second->getInputData()->getTensorDesc().getDims().size() == 4) {
         // this is image tensor
         item.second->setPrecision(p);
-        item.second->setLayout(layout);
+        if (preprocess == preprocess_mode::PLUGIN) {
+          // the decoded image is bound as is, the plugin resizes it and
+          // converts it to the layout of the network
+          item.second->setLayout(Layout::NHWC);
+          item.second->getPreProcess().setResizeAlgorithm(RESIZE_BILINEAR);
+        } else {
+          item.second->setLayout(layout);
+        }
       } else if (item.second->getInputData()
                      ->getTensorDesc()
                      .getDims()
@@ -229,74 +626,96 @@ protected:
   /**
    * @brief Do inference and return the infered request
    * @details
+   * @param slot
    * @param data
    * @param size
+   * @param format format of the data
    * @return InferRequest::Ptr
    */
-  network_output do_infer(const char* data, int size) {
+  network_output do_infer(infer_slot& slot, const char* data, int size,
+                          const image_format& format) {
+    inference_params params;
+    params.input = format;
+    return do_infer_batch(slot, &data, &size, &params, 1)[0];
+  }
+  /**
+   * @brief Do inference on a batch of images in one inference request
+   * @details All images share the same request, network_output::batch_id
+   * tells the parser where each image is in the output blobs. An image that
+   * cannot be decoded gets a null request and is left out of the batch.
+   * @param slot the request to run the batch on
+   * @param data encoded images
+   * @param size size of each encoded image
+   * @param params options of each image, only the input format is used
+   * @param n number of images, at most batch_size
+   * @return std::vector<network_output> one output per image, in order
+   */
+  std::vector<network_output> do_infer_batch(infer_slot& slot,
+                                             const char* const* data,
+                                             const int* size,
+                                             const inference_params* params,
+                                             size_t n) {
+    std::vector<network_output> ret(n, network_output{nullptr, -1, -1, 0});
     try {
       std::chrono::time_point<std::chrono::system_clock> start;
       std::chrono::time_point<std::chrono::system_clock> end;
       std::chrono::duration<double, std::milli> elapsed_mil;
 
-      // decode out image
+      // decode out images
       start = std::chrono::system_clock::now();
-      cv::Mat frame =
-          cv::imdecode(cv::Mat(1, size, CV_8UC3, (unsigned char*)data),
-                       cv::IMREAD_UNCHANGED);
-      const int width = frame.size().width;
-      const int height = frame.size().height;
+      std::vector<cv::Mat> frames;
+      std::vector<cv::Size> originals;  // size of the encoded images
+      std::vector<size_t> index;  // frames[k] is the image data[index[k]]
+      frames.reserve(n);
+      originals.reserve(n);
+      index.reserve(n);
+      for (size_t i = 0; i < n; ++i) {
+        cv::Size original;
+        cv::Mat frame =
+            decode_image(data[i], size[i], params[i].input, &original);
+        if (frame.empty()) continue;
+        frames.push_back(std::move(frame));
+        originals.push_back(original);
+        index.push_back(i);
+      }
       end = std::chrono::system_clock::now();
       elapsed_mil = end - start;
-      ovn_log->debug("Decode image in {} ms", elapsed_mil.count());
+      ovn_log->debug("Decode {} images in {} ms", frames.size(),
+                     elapsed_mil.count());
+      if (frames.empty()) return ret;
 
-      // create new request
+      // fill the pre-bound input of the request
       start = std::chrono::system_clock::now();
-      auto input_info = exe_network.GetInputsInfo();
-      InferRequest::Ptr infer_request = exe_network.CreateInferRequestPtr();
-      int input_width = -1, input_height = -1;
-      // prepare input blob
-      for (auto it = input_info.begin(); it != input_info.end(); it++) {
-        auto name = it->first;
-        auto input = it->second;
-        if (input->getTensorDesc().getDims().size() == 4) {
-          input_width = input->getTensorDesc().getDims()[2];
-          input_height = input->getTensorDesc().getDims()[3];
-        }
+      InferRequest::Ptr& infer_request = slot.request;
+      for (size_t k = 0; k < frames.size(); ++k) {
+        fill_input(slot, frames[k], k);
       }
-      for (auto it = input_info.begin(); it != input_info.end(); it++) {
-        auto name = it->first;
-        auto input = it->second;
-        if (input->getTensorDesc().getDims().size() == 4) {
-          frameToBlob(frame, infer_request, name);
-        } else if (input->getTensorDesc().getDims().size() == 2) { // faster rcnn
-          Blob::Ptr input2 = infer_request->GetBlob(name);
-          float* p = input2->buffer()
-                         .as<PrecisionTrait<Precision::FP32>::value_type*>();
-          assert(input_width > 0);
-          assert(input_height > 0);
-          p[0] = static_cast<float>(input_width);
-          p[1] = static_cast<float>(input_height);
-          p[2] = 1.0;
-        }
+      // only the first frames.size() images of the batch are computed
+      if (batch_size > 1) {
+        infer_request->SetBatch(frames.size());
       }
       // do inference
       infer_request->Infer();
       end = std::chrono::system_clock::now();  // sync mode only
       elapsed_mil = end - start;
-      ovn_log->debug("Create and do inference request in {} ms",
-                 elapsed_mil.count());
+      ovn_log->debug("Fill and do inference request of {} images in {} ms",
+                     frames.size(), elapsed_mil.count());
       #if NDEBUG
 
       #else
         print_perf_counts(*infer_request, std::cout);
       #endif
-      return {infer_request, width, height};
-    } 
-    catch (const cv::Exception& e) {
-      // let not opencv silly exception terminate our program
+      for (size_t k = 0; k < frames.size(); ++k) {
+        ret[index[k]] = {infer_request, originals[k].width,
+                         originals[k].height, static_cast<int>(k)};
+      }
+      return ret;
+    }
+    catch (const std::exception& e) {
+      // neither opencv nor the plugin may take the worker down, the images
+      // are answered without detections
       std::cerr << "Error: " << e.what() << std::endl;
-      return {nullptr, -1, -1};
+      return ret;
     }
   }
   /**
@@ -322,71 +741,51 @@ public:
    * @param model
    * @param device
    * @param label
+   * @param max_batch
+   * @param max_requests
+   * @param mode where the images are preprocessed
    */
   openvino_ssd(const std::string& device, const std::string& model,
-               const std::string& label) {
-    init_plugin(device);
-    load_network(model);
-    init_IO(Precision::U8, Layout::NCHW);
-    // load_plugin({});
+               const std::string& label, int max_batch = 1,
+               int max_requests = 1,
+               preprocess_mode mode = preprocess_mode::HOST) {
+    batch_size = max_batch;
+    num_requests = max_requests;
+    preprocess = mode;
+    init_network(device, model, Precision::U8, Layout::NCHW);
     set_labels(label);
   }
   // detection parser implementation for ssd
-  std::vector<bbox> detection_parser(network_output& net_out) final {
-    std::vector<bbox> ret = {};  // return value
+  void detection_parser(network_output& net_out,
+                        detection_result& result) final {
     try {
       ovn_log->debug("Parsing ssd output");
       std::chrono::time_point<std::chrono::system_clock> start;
       std::chrono::time_point<std::chrono::system_clock> end;
       std::chrono::duration<double, std::milli> elapsed_mil;
       start = std::chrono::system_clock::now();
-      auto &infer_request = net_out.infer_request;
-      auto width = net_out.width;
-      auto height = net_out.height;
-      auto outputInfo = OutputsDataMap(network.getOutputsInfo());
-      auto output_name = outputInfo.begin()->first;
-      auto blob = infer_request->GetBlob(output_name);
+      auto blob = net_out.infer_request->GetBlob(output_names[0]);
       const float* detections =
           blob->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>();
-      auto dims = blob->dims();
-      const int maxProposalCount = dims[1];
-      const int objectSize = dims[0];
-      ovn_log->trace("TopK {}, object size {}", maxProposalCount, objectSize);
-      for (int i = 0; i < maxProposalCount; i++) {
-        float image_id = detections[i * objectSize + 0];
-        if (image_id < 0) {
-          break;
-        }
-        float confidence = detections[i * objectSize + 2];
-        auto label_id = static_cast<int>(detections[i * objectSize + 1]);
-        if (label_id <= 0) break;
-        int xmin = detections[i * objectSize + 3] * width;
-        int ymin = detections[i * objectSize + 4] * height;
-        int xmax = detections[i * objectSize + 5] * width;
-        int ymax = detections[i * objectSize + 6] * height;
-        ovn_log->trace("{} {} {} {} {} {} {} {}", i, image_id, label_id, confidence, xmin, ymin, xmax, ymax);
-        auto label = labels[label_id - 1];
-        ovn_log->trace("Object: {}", label);
-        if (confidence > 0.45) {
-          bbox d;
-          d.prop = confidence;
-          d.label_id = label_id;
-          d.label = std::move(label);
-          d.c[0] = xmin;
-          d.c[1] = ymin;
-          d.c[2] = xmax;
-          d.c[3] = ymax;
-          ret.push_back(std::move(d));
-        }
+      // dims() is in reverse order: the rows, then the values of a row
+      const int maxProposalCount = blob->dims()[1];
+      if (blob->dims()[0] != 7) {
+        ovn_log->error("Expected 7 values per detection, got {}",
+                       blob->dims()[0]);
+        return;
       }
+      thread_local detection_columns boxes;
+      parse_detection_output<7, ssd_rows>(
+          detections, maxProposalCount, net_out.batch_id,
+          net_out.params.min_confidence_or(0.45f), net_out.width,
+          net_out.height, boxes);
+      append_boxes(boxes, result);
       end = std::chrono::system_clock::now();  // sync mode only
       elapsed_mil = end - start;
       ovn_log->debug("Parsing ssd output in {} ms", elapsed_mil.count());
-      return ret;
     }
     catch (const cv::Exception& e) {
       std::cerr << "Error: " << e.what() << std::endl;
-      return ret;
     }
   }
 
@@ -430,79 +829,73 @@ public:
    * @param model
    * @param device
    * @param label
+   * @param max_batch
+   * @param max_requests
+   * @param mode where the images are preprocessed
    */
   openvino_yolo(const std::string& device, const std::string& model,
-                const std::string& label) {
-    init_plugin(device);
-    load_network(model);
-    init_IO(Precision::U8, Layout::NCHW);
-    // load_plugin({});
+                const std::string& label, int max_batch = 1,
+                int max_requests = 1,
+                preprocess_mode mode = preprocess_mode::HOST) {
+    batch_size = max_batch;
+    num_requests = max_requests;
+    preprocess = mode;
+    init_network(device, model, Precision::U8, Layout::NCHW);
+    init_regions();
     set_labels(label);
   }
   // detection parser implementation for yolo
-  std::vector<bbox> detection_parser(network_output& net_out) final {
-    std::vector<bbox> ret;
+  void detection_parser(network_output& net_out,
+                        detection_result& result) final {
     try {
       ovn_log->debug("Parsing yolo output");
       std::chrono::time_point<std::chrono::system_clock> start;
       std::chrono::time_point<std::chrono::system_clock> end;
       std::chrono::duration<double, std::milli> elapsed_mil;
       start = std::chrono::system_clock::now();
-      auto infer_request = net_out.infer_request;
-      auto width = net_out.width;
-      auto height = net_out.height;
-      // process YOLO output, it's quite complicated though
-      auto input_info = exe_network.GetInputsInfo();
-      auto output_info = exe_network.GetOutputsInfo();
-      start = std::chrono::system_clock::now();
-      unsigned long resized_im_h =
-          input_info.begin()->second.get()->getDims()[0];
-      unsigned long resized_im_w =
-          input_info.begin()->second.get()->getDims()[1];
+      auto& infer_request = net_out.infer_request;
+      // boxes are found in the network input, then scaled to the image
+      const float h_scale =
+          static_cast<float>(net_out.height) / static_cast<float>(input_height);
+      const float w_scale =
+          static_cast<float>(net_out.width) / static_cast<float>(input_width);
       std::vector<detection_object> objects;
-      // Parsing outputs
-      for (auto& output : output_info) {
-        auto output_name = output.first;
-        CNNLayerPtr layer = get_layer(output_name.c_str());
-        Blob::Ptr blob = infer_request->GetBlob(output_name);
-        parse_yolov3_output(layer, blob, resized_im_h, resized_im_w, height,
-                            width, 0.5, objects);
+      for (auto& region : regions) {
+        parse_yolov3_output(region, infer_request->GetBlob(region.name),
+                            net_out.batch_id, h_scale, w_scale, 0.5f,
+                            objects);
       }
-      // Filtering overlapping boxes
-      std::sort(objects.begin(), objects.end(),
-                std::greater<detection_object>());
-      for (size_t i = 0; i < objects.size(); ++i) {
-        if (objects[i].confidence == 0) continue;
-        for (size_t j = i + 1; j < objects.size(); ++j)
-          if (intersection_over_union(objects[i], objects[j]) >= 0.4)
-            objects[j].confidence = 0;
+      // Filtering overlapping boxes of the same class
+      thread_local box_nms nms;
+      nms.clear();
+      for (auto& object : objects) {
+        nms.add(object.xmin, object.ymin, object.xmax, object.ymax,
+                object.confidence, object.class_id);
       }
+      nms_params params;
+      params.iou_threshold = 0.4f;
+      std::vector<int> kept = nms.run(params);
+      std::sort(kept.begin(), kept.end(), [&objects](int a, int b) {
+        return objects[a] > objects[b];
+      });
       // Get the bboxes
-      for (auto& object : objects) {
-        bbox d;
+      for (int i : kept) {
+        const detection_object& object = objects[i];
         ovn_log->trace("{} {} {} {} {} {}", object.class_id, object.confidence, object.xmin, object.ymin, object.xmax, object.ymax);
         if (object.confidence < 0.4) continue;
-        auto label_id = object.class_id+1;
-        auto label = labels[label_id-1];
-        ovn_log->trace("Object: {}", label);
-        float confidence = object.confidence;
-        d.prop = confidence;
-        d.label_id = label_id;
-        d.label = std::move(label);
-        d.c[0] = object.xmin;
-        d.c[1] = object.ymin;
-        d.c[2] = object.xmax;
-        d.c[3] = object.ymax;
-        ret.push_back(std::move(d));
+        const bbox d = {object.class_id + 1, object.confidence,
+                        {static_cast<float>(object.xmin),
+                         static_cast<float>(object.ymin),
+                         static_cast<float>(object.xmax),
+                         static_cast<float>(object.ymax)}};
+        result.boxes.push_back(d);
       }
       end = std::chrono::system_clock::now();  // sync mode only
       elapsed_mil = end - start;
       ovn_log->debug("Parsing yolo output in {} ms", elapsed_mil.count());
-      return ret;
     } 
     catch (const cv::Exception& e) {
       std::cerr << e.what() << '\n';
-      return ret;
     }
   }
 
@@ -517,7 +910,7 @@ private:
     int xmin, ymin, xmax, ymax, class_id;
     float confidence;
 
-    detection_object(double x, double y, double h, double w, int class_id,
+    detection_object(float x, float y, float h, float w, int class_id,
                      float confidence, float h_scale, float w_scale) {
       this->xmin = static_cast<int>((x - w / 2) * w_scale);
       this->ymin = static_cast<int>((y - h / 2) * h_scale);
@@ -535,143 +928,133 @@ private:
     }
   };
   /**
-   * @brief
+   * @brief Parameters of a RegionYolo output, read once when the model is
+   * loaded
    *
-   * @param side
-   * @param lcoords
-   * @param lclasses
-   * @param location
-   * @param entry
-   * @return int
-   */
-  static int entry_index(int side, int lcoords, int lclasses, int location,
-                         int entry) {
-    int n = location / (side * side);
-    int loc = location % (side * side);
-    return n * side * side * (lcoords + lclasses + 1) + entry * side * side +
-           loc;
-  }
-  /**
-   * @brief IOU
+   */
+  struct region_info {
+    std::string name;            //!< name of the output
+    int side = 0;                //!< height and width of the grid
+    int num = 0;                 //!< number of anchors per cell
+    int coords = 0;              //!< number of box coordinates per anchor
+    int classes = 0;             //!< number of classes
+    size_t image_size = 0;       //!< number of values of one image
+    std::vector<float> anchors;  //!< width and height of each anchor
+  };
+  std::vector<region_info> regions;  //!< one per output scale
+  /**
+   * @brief Read the parameters of the RegionYolo outputs
    *
-   * @param box_1
-   * @param box_2
-   * @return double
-   */
-  double intersection_over_union(const detection_object& box_1,
-                                 const detection_object& box_2) {
-    double width_of_overlap_area =
-        fmin(box_1.xmax, box_2.xmax) - fmax(box_1.xmin, box_2.xmin);
-    double height_of_overlap_area =
-        fmin(box_1.ymax, box_2.ymax) - fmax(box_1.ymin, box_2.ymin);
-    double area_of_overlap;
-    if (width_of_overlap_area < 0 || height_of_overlap_area < 0)
-      area_of_overlap = 0;
-    else
-      area_of_overlap = width_of_overlap_area * height_of_overlap_area;
-    double box_1_area = (box_1.ymax - box_1.ymin) * (box_1.xmax - box_1.xmin);
-    double box_2_area = (box_2.ymax - box_2.ymin) * (box_2.xmax - box_2.xmin);
-    double area_of_union = box_1_area + box_2_area - area_of_overlap;
-    return area_of_overlap / area_of_union;
+   */
+  void init_regions() {
+    regions.clear();
+    auto output_info = OutputsDataMap(network.getOutputsInfo());
+    for (auto& item : output_info) {
+      CNNLayerPtr layer = get_layer(item.first.c_str());
+      if (layer->type != "RegionYolo")
+        throw std::runtime_error("Invalid output type: " + layer->type +
+                                 ". RegionYolo expected");
+      const SizeVector dims = item.second->getTensorDesc().getDims();
+      if (dims.size() != 4 || dims[2] != dims[3])
+        throw std::runtime_error("Invalid size of output " + layer->name +
+                                 " It should be in NCHW layout and H should "
+                                 "be equal to W.");
+      region_info region;
+      region.name = item.first;
+      region.side = static_cast<int>(dims[2]);
+      region.image_size = dims[1] * dims[2] * dims[3];
+      region.coords = layer->GetParamAsInt("coords");
+      region.classes = layer->GetParamAsInt("classes");
+      std::vector<float> anchors = {10.0,  13.0, 16.0,  30.0,  33.0,  23.0,
+                                    30.0,  61.0, 62.0,  45.0,  59.0,  119.0,
+                                    116.0, 90.0, 156.0, 198.0, 373.0, 326.0};
+      try {
+        anchors = layer->GetParamAsFloats("anchors");
+      } catch (...) {
+      }
+      // anchors used by this output
+      std::vector<int> mask;
+      try {
+        mask = layer->GetParamAsInts("mask");
+      } catch (...) {
+      }
+      if (mask.empty()) {
+        // no mask, the anchors are picked from the size of the output
+        region.num = layer->GetParamAsInt("num");
+        int anchor_offset = 0;
+        switch (region.side) {
+          case 13:
+            anchor_offset = 6;
+            break;
+          case 26:
+            anchor_offset = 3;
+            break;
+          case 52:
+            anchor_offset = 0;
+            break;
+          default:
+            throw std::runtime_error("Invalid output size");
+        }
+        for (int n = 0; n < region.num; ++n) mask.push_back(anchor_offset + n);
+      }
+      region.num = static_cast<int>(mask.size());
+      for (int m : mask) {
+        if (m < 0 || 2 * static_cast<size_t>(m) + 1 >= anchors.size())
+          throw std::runtime_error("Invalid anchor mask of " + layer->name);
+        region.anchors.push_back(anchors[2 * m]);
+        region.anchors.push_back(anchors[2 * m + 1]);
+      }
+      ovn_log->debug("Region {}: side {}, {} anchors, {} classes", region.name,
+                     region.side, region.num, region.classes);
+      regions.push_back(std::move(region));
+    }
   }
   /**
    * @brief Parsing YOLO output
-   *
-   * @param layer
+   * @details The objectness of each anchor is a plane of side x side scores,
+   * it is thresholded with threshold_scan and the box and the class scores are
+   * only read for the cells above the threshold.
+   * @param region
    * @param blob
-   * @param resized_im_h
-   * @param resized_im_w
-   * @param original_im_h
-   * @param original_im_w
+   * @param batch_id
+   * @param h_scale height of the image over height of the network input
+   * @param w_scale width of the image over width of the network input
    * @param threshold
    * @param objects
    */
-  void parse_yolov3_output(const CNNLayerPtr& layer, const Blob::Ptr& blob,
-                           const unsigned long resized_im_h,
-                           const unsigned long resized_im_w,
-                           const unsigned long original_im_h,
-                           const unsigned long original_im_w,
-                           const double threshold,
+  void parse_yolov3_output(const region_info& region, const Blob::Ptr& blob,
+                           const int batch_id, const float h_scale,
+                           const float w_scale, const float threshold,
                            std::vector<detection_object>& objects) {
-    // --------------------------- Validating output parameters
-    // -------------------------------------
-    if (layer->type != "RegionYolo")
-      throw std::runtime_error("Invalid output type: " + layer->type +
-                               ". RegionYolo expected");
-    const int out_blob_h = static_cast<int>(blob->getTensorDesc().getDims()[2]);
-    const int out_blob_w = static_cast<int>(blob->getTensorDesc().getDims()[3]);
-    if (out_blob_h != out_blob_w)
-      throw std::runtime_error("Invalid size of output " + layer->name +
-                               " It should be in NCHW layout and H should be "
-                               "equal to W. Current H = " +
-                               std::to_string(out_blob_h) + ", current W = " +
-                               std::to_string(out_blob_h));
-    // --------------------------- Extracting layer parameters
-    // -------------------------------------
-    auto num = layer->GetParamAsInt("num");
-    try {
-      num = layer->GetParamAsInts("mask").size();
-    } catch (...) {
-    }
-    auto coords = layer->GetParamAsInt("coords");
-    auto classes = layer->GetParamAsInt("classes");
-    std::vector<float> anchors = {10.0,  13.0, 16.0,  30.0,  33.0,  23.0,
-                                  30.0,  61.0, 62.0,  45.0,  59.0,  119.0,
-                                  116.0, 90.0, 156.0, 198.0, 373.0, 326.0};
-    try {
-      anchors = layer->GetParamAsFloats("anchors");
-    } catch (...) {
-    }
-    auto side = out_blob_h;
-    int anchor_offset = 0;
-    std::cout << side << std::endl;
-    switch (side) {
-      case 13:
-        anchor_offset = 2 * 6;
-        break;
-      case 26:
-        anchor_offset = 2 * 3;
-        break;
-      case 52:
-        anchor_offset = 2 * 0;
-        break;
-      default:
-        throw std::runtime_error("Invalid output size");
-    }
-    auto side_square = side * side;
+    const int side = region.side;
+    const int side_square = side * side;
+    const int entry_size = region.coords + region.classes + 1;
     const float* output_blob =
-        blob->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>();
-    // --------------------------- Parsing YOLO Region output
-    // -------------------------------------
-    for (int i = 0; i < side_square; ++i) {
-      int row = i / side;
-      int col = i % side;
-      for (int n = 0; n < num; ++n) {
-        int obj_index =
-            entry_index(side, coords, classes, n * side * side + i, coords);
-        int box_index =
-            entry_index(side, coords, classes, n * side * side + i, 0);
-        float scale = output_blob[obj_index];
-        if (scale < threshold) continue;
-        double x = (col + output_blob[box_index + 0 * side_square]) / side *
-                   resized_im_w;
-        double y = (row + output_blob[box_index + 1 * side_square]) / side *
-                   resized_im_h;
-        double height = std::exp(output_blob[box_index + 3 * side_square]) *
-                        anchors[anchor_offset + 2 * n + 1];
-        double width = std::exp(output_blob[box_index + 2 * side_square]) *
-                       anchors[anchor_offset + 2 * n];
-        for (int j = 0; j < classes; ++j) {
-          int class_index = entry_index(side, coords, classes,
-                                        n * side_square + i, coords + 1 + j);
-          float prob = scale * output_blob[class_index];
+        blob->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>() +
+        batch_id * region.image_size;
+    std::vector<int> cells;
+    for (int n = 0; n < region.num; ++n) {
+      // each entry of an anchor is a plane of side x side values: the box,
+      // the objectness, then the class scores
+      const float* box = output_blob + n * side_square * entry_size;
+      const float* objectness = box + region.coords * side_square;
+      const float* scores = objectness + side_square;
+      cells.clear();
+      threshold_scan(objectness, side_square, threshold, cells);
+      for (int i : cells) {
+        const int row = i / side;
+        const int col = i % side;
+        const float scale = objectness[i];
+        const float x = (col + box[i]) / side * input_width;
+        const float y = (row + box[side_square + i]) / side * input_height;
+        const float height =
+            std::exp(box[3 * side_square + i]) * region.anchors[2 * n + 1];
+        const float width =
+            std::exp(box[2 * side_square + i]) * region.anchors[2 * n];
+        for (int j = 0; j < region.classes; ++j) {
+          const float prob = scale * scores[j * side_square + i];
           if (prob < threshold) continue;
-          detection_object obj(x, y, height, width, j, prob,
-                               static_cast<float>(original_im_h) /
-                                   static_cast<float>(resized_im_h),
-                               static_cast<float>(original_im_w) /
-                                   static_cast<float>(resized_im_w));
-          objects.push_back(obj);
+          objects.emplace_back(x, y, height, width, j, prob, h_scale, w_scale);
         }
       }
     }
@@ -690,68 +1073,51 @@ public:
    * @param device
    * @param model
    * @param label
+   * @param max_batch
+   * @param max_requests
+   * @param mode where the images are preprocessed
    */
   openvino_frcnn(const std::string& device, const std::string& model,
-                 const std::string& label) {
-    init_plugin(device);
-    load_network(model);
-    init_IO(Precision::U8, Layout::NCHW);
-    // load_plugin({});
+                 const std::string& label, int max_batch = 1,
+                 int max_requests = 1,
+                 preprocess_mode mode = preprocess_mode::HOST) {
+    batch_size = max_batch;
+    num_requests = max_requests;
+    preprocess = mode;
+    init_network(device, model, Precision::U8, Layout::NCHW);
     set_labels(label);
   }
 
   // frcnn detection parser implementation
-  std::vector<bbox> detection_parser(network_output& net_out) final {
-    std::vector<bbox> ret = {};  // return value
+  void detection_parser(network_output& net_out,
+                        detection_result& result) final {
     try {
       std::chrono::time_point<std::chrono::system_clock> start;
       std::chrono::time_point<std::chrono::system_clock> end;
       std::chrono::duration<double, std::milli> elapsed_mil;
       start = std::chrono::system_clock::now();
-      auto infer_request = net_out.infer_request;
-      auto width = net_out.width;
-      auto height = net_out.height;
-      auto outputInfo = OutputsDataMap(network.getOutputsInfo());
-      auto output_name = outputInfo.begin()->first;
-      auto blob = infer_request->GetBlob(output_name);
+      auto blob = net_out.infer_request->GetBlob(output_names[0]);
       const float* detections =
           blob->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>();
-      auto dims = blob->dims();
-      const int maxProposalCount = dims[1];
-      const int objectSize = dims[0];
-      for (int i = 0; i < maxProposalCount; i++) {
-        float image_id = detections[i * objectSize + 0];
-        if (image_id < 0) {
-          break;
-        }
-        float confidence = detections[i * objectSize + 2];
-        auto label_id = static_cast<int>(detections[i * objectSize + 1]);
-        int xmin = detections[i * objectSize + 3] * width;
-        int ymin = detections[i * objectSize + 4] * height;
-        int xmax = detections[i * objectSize + 5] * width;
-        int ymax = detections[i * objectSize + 6] * height;
-        auto label = labels[label_id - 1];
-
-        if (confidence > 0.45) {
-          bbox d;
-          d.prop = confidence;
-          d.label_id = label_id;
-          d.label = std::move(label);
-          d.c[0] = xmin;
-          d.c[1] = ymin;
-          d.c[2] = xmax;
-          d.c[3] = ymax;
-          ret.push_back(std::move(d));
-        }
+      // dims() is in reverse order: the rows, then the values of a row
+      const int maxProposalCount = blob->dims()[1];
+      if (blob->dims()[0] != 7) {
+        ovn_log->error("Expected 7 values per detection, got {}",
+                       blob->dims()[0]);
+        return;
       }
+      thread_local detection_columns boxes;
+      parse_detection_output<7, frcnn_rows>(
+          detections, maxProposalCount, net_out.batch_id,
+          net_out.params.min_confidence_or(0.45f), net_out.width,
+          net_out.height, boxes);
+      append_boxes(boxes, result);
       end = std::chrono::system_clock::now();  // sync mode only
       elapsed_mil = end - start;
       ovn_log->debug("Parsing network output in {} ms", elapsed_mil.count());
-      return ret;
     } 
     catch (const cv::Exception& e) {
       std::cerr << "Error: " << e.what() << std::endl;
-      return ret;
     }
   }
 
@@ -785,6 +1151,16 @@ protected:
     }
   }
 };  // class openvino_frcnn
+/**
+ * @brief Output options of the classification network
+ *
+ */
+struct classification_params {
+  int top_k = 10;                //!< number of classes returned
+  float min_confidence = 0.01f;  //!< only the classes above it are returned
+  bool softmax = false;          //!< the outputs are logits, apply a softmax
+  float temperature = 1.f;       //!< softmax of logits / temperature
+};
 class openvino_anynet_classification : public openvino_inference_engine {
   public:
   /**
@@ -793,65 +1169,104 @@ class openvino_anynet_classification : public openvino_inference_engine {
    * @param device
    * @param model
    * @param label
+   * @param max_batch
+   * @param max_requests
+   * @param mode where the images are preprocessed
+   * @param _output default output options, a request can override top_k
+   * and min_confidence
    */
   openvino_anynet_classification(const std::string& device, 
                                  const std::string& model,
-                                 const std::string& label) {
-    init_plugin(device);
-    load_network(model);
-    init_IO(Precision::U8, Layout::NCHW);
+                                 const std::string& label,
+                                 int max_batch = 1,
+                                 int max_requests = 1,
+                                 preprocess_mode mode = preprocess_mode::HOST,
+                                 classification_params _output =
+                                     classification_params())
+      : output(_output) {
+    batch_size = max_batch;
+    num_requests = max_requests;
+    preprocess = mode;
+    init_network(device, model, Precision::U8, Layout::NCHW);
+    init_output();
     set_labels(label);
   }
 
-  std::vector<bbox> detection_parser(network_output& net_out) final {
-    std::vector<bbox> ret = {};  // return value
+  void detection_parser(network_output& net_out,
+                        detection_result& result) final {
     try {
       ovn_log->debug("Parsing classification output");
       std::chrono::time_point<std::chrono::system_clock> start;
       std::chrono::time_point<std::chrono::system_clock> end;
       std::chrono::duration<double, std::milli> elapsed_mil;
       start = std::chrono::system_clock::now();
-      auto &infer_request = net_out.infer_request;
-      auto outputInfo = OutputsDataMap(network.getOutputsInfo());
-      auto output_name = outputInfo.begin()->first;
-      auto blob = infer_request->GetBlob(output_name);
+      const int k = net_out.params.top_k_or(output.top_k);
+      const float min_confidence =
+          net_out.params.min_confidence_or(output.min_confidence);
+      auto blob = net_out.infer_request->GetBlob(output_names[0]);
       const float* scores =
-          blob->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>();
-      auto dims = blob->dims();
-      int num_class = dims[0];
-      std::vector<int> idx(num_class);
-      ovn_log->trace("Number of classes: {}", num_class);
-      std::iota(idx.begin(), idx.end(), 0);
-      auto comp = [&](int x, int y) {
-        return scores[x] > scores[y];
-      };
-      std::sort(idx.begin(), idx.end(), comp);
-      for (int i = 0; i < 10; i++) {
-        int cls_id = idx[i];
-        float confidence = scores[cls_id];
+          blob->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>() +
+          net_out.batch_id * num_class;
+      thread_local std::vector<std::pair<float, int>> top;
+      float max = 0.f, scale = 1.f, sum = 1.f;
+      if (output.softmax) {
+        // the softmax keeps the order, select on the logits and only turn
+        // the selected ones into probabilities
+        top_k_scores(scores, num_class, k,
+                     -std::numeric_limits<float>::infinity(), top);
+        if (!top.empty()) {
+          max = top[0].first;
+          scale = 1.f / output.temperature;
+          sum = exp_sum(scores, num_class, max, scale);
+        }
+      } else {
+        top_k_scores(scores, num_class, k, min_confidence, top);
+      }
+      for (size_t i = 0; i < top.size(); ++i) {
+        const int cls_id = top[i].second;
+        float confidence = top[i].first;
+        if (output.softmax) {
+          confidence = std::exp((confidence - max) * scale) / sum;
+        }
         ovn_log->trace("{} {} {}", i, cls_id, confidence);
         if (cls_id <= 0) break;
-        auto label = labels[cls_id - 1];
-        ovn_log->trace("Class: {}", label);
-        if (confidence > 0.01) {
-          bbox d;
-          d.prop = confidence;
-          d.label_id = cls_id;
-          d.label = std::move(label);
-          ret.push_back(std::move(d));
-        }
+        if (confidence <= min_confidence) break;
+        const bbox d = {cls_id, confidence, {0.f, 0.f, 0.f, 0.f}};
+        result.boxes.push_back(d);
       }
       end = std::chrono::system_clock::now();  // sync mode only
       elapsed_mil = end - start;
       ovn_log->debug("Parsing network output in {} ms", elapsed_mil.count());
-      return ret;
     }
     catch (const cv::Exception& e) {
       std::cerr << "Error: " << e.what() << std::endl;
-      return ret;
     }
   }
   private:
+  classification_params output;  //!< default output options
+  int num_class = 0;             //!< number of scores of one image
+  /**
+   * @brief Read the size of the output once the model is loaded
+   *
+   */
+  void init_output() {
+    auto output_info = OutputsDataMap(network.getOutputsInfo());
+    if (output_info.size() != 1) {
+      throw std::logic_error("Classification network should have only one "
+                             "output");
+    }
+    const SizeVector dims =
+        output_info.begin()->second->getTensorDesc().getDims();
+    // every dimension but the batch, e.g. N x C or N x C x 1 x 1
+    num_class = 1;
+    for (size_t i = 1; i < dims.size(); ++i) {
+      num_class *= static_cast<int>(dims[i]);
+    }
+    ovn_log->debug("Number of classes: {}", num_class);
+    if (output.temperature <= 0) {
+      throw std::logic_error("Temperature of the softmax should be positive");
+    }
+  }
 }; // class openvino_anynet_classification
 }  // namespace ie
 }  // namespace st
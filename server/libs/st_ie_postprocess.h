@@ -0,0 +1,660 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the output postprocessing kernels shared by the
+ * inference engines
+ ***************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "st_simd.h"
+
+namespace st {
+namespace ie {
+
+/**
+ * @brief Axis aligned box with its area
+ *
+ */
+struct area_box {
+  float x0, y0, x1, y1;  //!< top left and bottom right corners
+  float area;            //!< (x1 - x0) * (y1 - y0)
+};
+
+/**
+ * @brief Boxes stored as one array per field, so that one box can be compared
+ * with several boxes at once
+ *
+ */
+struct box_columns {
+  std::vector<float> x0, y0, x1, y1, area;
+  size_t size() const { return x0.size(); }
+  void clear() {
+    x0.clear();
+    y0.clear();
+    x1.clear();
+    y1.clear();
+    area.clear();
+  }
+  void push_back(const area_box& b) {
+    x0.push_back(b.x0);
+    y0.push_back(b.y0);
+    x1.push_back(b.x1);
+    y1.push_back(b.y1);
+    area.push_back(b.area);
+  }
+  area_box get(size_t i) const {
+    return {x0[i], y0[i], x1[i], y1[i], area[i]};
+  }
+  // replace box i with the last box, the order is not kept
+  void swap_remove(size_t i) {
+    x0[i] = x0.back();
+    y0[i] = y0.back();
+    x1[i] = x1.back();
+    y1[i] = y1.back();
+    area[i] = area.back();
+    x0.pop_back();
+    y0.pop_back();
+    x1.pop_back();
+    y1.pop_back();
+    area.pop_back();
+  }
+};
+
+/**
+ * @brief Boxes of a DetectionOutput layer, stored as one array per field
+ *
+ */
+struct detection_columns {
+  std::vector<int> label_id;
+  std::vector<float> confidence;
+  std::vector<int> x0, y0, x1, y1;  //!< corners in pixels of the image
+  size_t size() const { return label_id.size(); }
+  void resize(size_t n) {
+    label_id.resize(n);
+    confidence.resize(n);
+    x0.resize(n);
+    y0.resize(n);
+    x1.resize(n);
+    y1.resize(n);
+  }
+};
+
+/**
+ * @brief Row policy of SSD: the rows of an image are sorted by label, the
+ * first background row ends the detections
+ *
+ */
+struct ssd_rows {
+  static bool end(int label_id) { return label_id <= 0; }
+};
+
+/**
+ * @brief Row policy of Faster R-CNN: the rows are not sorted, background rows
+ * are skipped
+ *
+ */
+struct frcnn_rows {
+  static bool end(int label_id) { return false; }
+};
+
+/**
+ * @brief Parse the output of a DetectionOutput layer
+ * @details Each row is [image_id, label, confidence, x0, y0, x1, y1] with
+ * normalized coordinates, and the rows end at the first image_id of -1. The
+ * rows are first counted, then the boxes of all rows are written to out and
+ * only kept when they pass the filter, with no branch in the loop so that the
+ * compiler can vectorize it. The buffers of out are reused, nothing is
+ * allocated once they are large enough.
+ * @tparam ObjectSize number of floats per row, at least 7, the caller checks
+ * that it matches the output blob
+ * @tparam Rows ssd_rows or frcnn_rows
+ * @param rows output blob
+ * @param num_rows maximum number of rows
+ * @param image_id index of the image in the batch
+ * @param threshold only the boxes above this confidence are kept
+ * @param width width of the image
+ * @param height height of the image
+ * @param out the kept boxes, in the order of the rows
+ */
+template <int ObjectSize, class Rows>
+inline void parse_detection_output(const float* rows, int num_rows,
+                                   int image_id, float threshold, int width,
+                                   int height, detection_columns& out) {
+  static_assert(ObjectSize >= 7, "DetectionOutput rows have 7 values");
+  int n = 0;
+  for (; n < num_rows; ++n) {
+    const float* r = rows + n * ObjectSize;
+    if (r[0] < 0) break;
+    // the rows of the other images of the batch don't end this one
+    if (static_cast<int>(r[0]) != image_id) continue;
+    if (Rows::end(static_cast<int>(r[1]))) break;
+  }
+  out.resize(n);
+  const float w = static_cast<float>(width);
+  const float h = static_cast<float>(height);
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    const float* r = rows + i * ObjectSize;
+    const int label_id = static_cast<int>(r[1]);
+    out.label_id[count] = label_id;
+    out.confidence[count] = r[2];
+    out.x0[count] = static_cast<int>(r[3] * w);
+    out.y0[count] = static_cast<int>(r[4] * h);
+    out.x1[count] = static_cast<int>(r[5] * w);
+    out.y1[count] = static_cast<int>(r[6] * h);
+    count += (static_cast<int>(r[0]) == image_id) & (r[2] > threshold) &
+             (label_id > 0);
+  }
+  out.resize(count);
+}
+
+namespace postprocess {
+
+/****************************************************************/
+/*  Threshold scan                                              */
+/****************************************************************/
+
+inline void threshold_scan_scalar(const float* src, int n, float threshold,
+                                  int i, std::vector<int>& hits) {
+  for (; i < n; ++i) {
+    if (src[i] >= threshold) hits.push_back(i);
+  }
+}
+
+/****************************************************************/
+/*  Top-k selection                                             */
+/****************************************************************/
+
+using scored_index = std::pair<float, int>;  //!< score and index
+
+// higher score first, lower index first among equal scores
+inline bool score_better(const scored_index& a, const scored_index& b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+// the heap keeps the k best scores with the worst one in front, a score must
+// be above the returned floor to enter it
+inline float top_k_floor(const std::vector<scored_index>& heap, size_t k,
+                         float min_score) {
+  return heap.size() < k ? min_score : std::max(min_score, heap.front().first);
+}
+
+inline void top_k_push(float score, int i, size_t k, float min_score,
+                       std::vector<scored_index>& heap) {
+  if (!(score > min_score)) return;
+  if (heap.size() < k) {
+    heap.emplace_back(score, i);
+    std::push_heap(heap.begin(), heap.end(), score_better);
+  } else if (score > heap.front().first) {
+    // the scan goes by increasing index, an equal score never wins
+    std::pop_heap(heap.begin(), heap.end(), score_better);
+    heap.back() = scored_index(score, i);
+    std::push_heap(heap.begin(), heap.end(), score_better);
+  }
+}
+
+inline void top_k_scan_scalar(const float* src, int n, size_t k,
+                              float min_score, int i,
+                              std::vector<scored_index>& heap) {
+  float floor = top_k_floor(heap, k, min_score);
+  for (; i < n; ++i) {
+    if (src[i] > floor) {
+      top_k_push(src[i], i, k, min_score, heap);
+      floor = top_k_floor(heap, k, min_score);
+    }
+  }
+}
+
+/****************************************************************/
+/*  Softmax                                                     */
+/****************************************************************/
+
+inline float exp_sum_scalar(const float* src, int n, float max, float scale,
+                            int i) {
+  float sum = 0.f;
+  for (; i < n; ++i) sum += std::exp((src[i] - max) * scale);
+  return sum;
+}
+
+/****************************************************************/
+/*  Intersection over union                                     */
+/****************************************************************/
+
+// intersection and union of two boxes, union is at least FLT_MIN
+inline void overlap_scalar(const box_columns& c, size_t i, const area_box& b,
+                           float& inter, float& uni) {
+  const float w = std::min(c.x1[i], b.x1) - std::max(c.x0[i], b.x0);
+  const float h = std::min(c.y1[i], b.y1) - std::max(c.y0[i], b.y0);
+  inter = std::max(w, 0.f) * std::max(h, 0.f);
+  uni = std::max(c.area[i] + b.area - inter, FLT_MIN);
+}
+
+inline bool iou_any_above_scalar(const box_columns& c, size_t i,
+                                 const area_box& b, float threshold) {
+  for (; i < c.size(); ++i) {
+    float inter, uni;
+    overlap_scalar(c, i, b, inter, uni);
+    if (inter > threshold * uni) return true;
+  }
+  return false;
+}
+
+inline void iou_row_scalar(const box_columns& c, size_t i, const area_box& b,
+                           float* iou) {
+  for (; i < c.size(); ++i) {
+    float inter, uni;
+    overlap_scalar(c, i, b, inter, uni);
+    iou[i] = inter / uni;
+  }
+}
+
+#if ST_SIMD_X86
+// intersection and union of the boxes i to i + 3 with a box
+ST_TARGET("sse4.1")
+inline void overlap_sse4(const box_columns& c, size_t i, const area_box& b,
+                         __m128& inter, __m128& uni) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 w =
+      _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(&c.x1[i]), _mm_set1_ps(b.x1)),
+                 _mm_max_ps(_mm_loadu_ps(&c.x0[i]), _mm_set1_ps(b.x0)));
+  const __m128 h =
+      _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(&c.y1[i]), _mm_set1_ps(b.y1)),
+                 _mm_max_ps(_mm_loadu_ps(&c.y0[i]), _mm_set1_ps(b.y0)));
+  inter = _mm_mul_ps(_mm_max_ps(w, zero), _mm_max_ps(h, zero));
+  const __m128 sum = _mm_add_ps(_mm_loadu_ps(&c.area[i]), _mm_set1_ps(b.area));
+  uni = _mm_max_ps(_mm_sub_ps(sum, inter), _mm_set1_ps(FLT_MIN));
+}
+
+ST_TARGET("sse4.1")
+inline bool iou_any_above_sse4(const box_columns& c, const area_box& b,
+                               float threshold) {
+  const __m128 t = _mm_set1_ps(threshold);
+  size_t i = 0;
+  for (; i + 4 <= c.size(); i += 4) {
+    __m128 inter, uni;
+    overlap_sse4(c, i, b, inter, uni);
+    if (_mm_movemask_ps(_mm_cmpgt_ps(inter, _mm_mul_ps(t, uni)))) return true;
+  }
+  return iou_any_above_scalar(c, i, b, threshold);
+}
+
+ST_TARGET("sse4.1")
+inline void iou_row_sse4(const box_columns& c, const area_box& b, float* iou) {
+  size_t i = 0;
+  for (; i + 4 <= c.size(); i += 4) {
+    __m128 inter, uni;
+    overlap_sse4(c, i, b, inter, uni);
+    _mm_storeu_ps(iou + i, _mm_div_ps(inter, uni));
+  }
+  iou_row_scalar(c, i, b, iou);
+}
+
+// intersection and union of the boxes i to i + 7 with a box
+ST_TARGET("avx2")
+inline void overlap_avx2(const box_columns& c, size_t i, const area_box& b,
+                         __m256& inter, __m256& uni) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 w = _mm256_sub_ps(
+      _mm256_min_ps(_mm256_loadu_ps(&c.x1[i]), _mm256_set1_ps(b.x1)),
+      _mm256_max_ps(_mm256_loadu_ps(&c.x0[i]), _mm256_set1_ps(b.x0)));
+  const __m256 h = _mm256_sub_ps(
+      _mm256_min_ps(_mm256_loadu_ps(&c.y1[i]), _mm256_set1_ps(b.y1)),
+      _mm256_max_ps(_mm256_loadu_ps(&c.y0[i]), _mm256_set1_ps(b.y0)));
+  inter = _mm256_mul_ps(_mm256_max_ps(w, zero), _mm256_max_ps(h, zero));
+  const __m256 sum =
+      _mm256_add_ps(_mm256_loadu_ps(&c.area[i]), _mm256_set1_ps(b.area));
+  uni = _mm256_max_ps(_mm256_sub_ps(sum, inter), _mm256_set1_ps(FLT_MIN));
+}
+
+ST_TARGET("avx2")
+inline bool iou_any_above_avx2(const box_columns& c, const area_box& b,
+                               float threshold) {
+  const __m256 t = _mm256_set1_ps(threshold);
+  size_t i = 0;
+  for (; i + 8 <= c.size(); i += 8) {
+    __m256 inter, uni;
+    overlap_avx2(c, i, b, inter, uni);
+    const __m256 above =
+        _mm256_cmp_ps(inter, _mm256_mul_ps(t, uni), _CMP_GT_OQ);
+    if (_mm256_movemask_ps(above)) return true;
+  }
+  return iou_any_above_scalar(c, i, b, threshold);
+}
+
+ST_TARGET("avx2")
+inline void iou_row_avx2(const box_columns& c, const area_box& b, float* iou) {
+  size_t i = 0;
+  for (; i + 8 <= c.size(); i += 8) {
+    __m256 inter, uni;
+    overlap_avx2(c, i, b, inter, uni);
+    _mm256_storeu_ps(iou + i, _mm256_div_ps(inter, uni));
+  }
+  iou_row_scalar(c, i, b, iou);
+}
+#endif  // ST_SIMD_X86
+
+#if ST_SIMD_X86
+// append the lanes set in a comparison mask
+inline void push_mask(unsigned int mask, int base, std::vector<int>& hits) {
+  while (mask) {
+    hits.push_back(base + __builtin_ctz(mask));
+    mask &= mask - 1;
+  }
+}
+
+ST_TARGET("sse4.1")
+inline void threshold_scan_sse4(const float* src, int n, float threshold,
+                                std::vector<int>& hits) {
+  const __m128 t = _mm_set1_ps(threshold);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 v = _mm_loadu_ps(src + i);
+    push_mask(_mm_movemask_ps(_mm_cmpge_ps(v, t)), i, hits);
+  }
+  threshold_scan_scalar(src, n, threshold, i, hits);
+}
+
+ST_TARGET("avx2")
+inline void threshold_scan_avx2(const float* src, int n, float threshold,
+                                std::vector<int>& hits) {
+  const __m256 t = _mm256_set1_ps(threshold);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 v = _mm256_loadu_ps(src + i);
+    push_mask(_mm256_movemask_ps(_mm256_cmp_ps(v, t, _CMP_GE_OQ)), i, hits);
+  }
+  threshold_scan_scalar(src, n, threshold, i, hits);
+}
+
+ST_TARGET("avx512f")
+inline void threshold_scan_avx512(const float* src, int n, float threshold,
+                                  std::vector<int>& hits) {
+  const __m512 t = _mm512_set1_ps(threshold);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 v = _mm512_loadu_ps(src + i);
+    push_mask(_mm512_cmp_ps_mask(v, t, _CMP_GE_OQ), i, hits);
+  }
+  threshold_scan_scalar(src, n, threshold, i, hits);
+}
+
+// the hits of a comparison mask go through the heap one by one, the floor
+// rises as the heap fills up so that few values pass the vector compare
+inline void top_k_mask(unsigned int mask, const float* src, int base, size_t k,
+                       float min_score, std::vector<scored_index>& heap) {
+  while (mask) {
+    const int i = base + __builtin_ctz(mask);
+    top_k_push(src[i], i, k, min_score, heap);
+    mask &= mask - 1;
+  }
+}
+
+ST_TARGET("sse4.1")
+inline void top_k_scan_sse4(const float* src, int n, size_t k, float min_score,
+                            std::vector<scored_index>& heap) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 t = _mm_set1_ps(top_k_floor(heap, k, min_score));
+    const __m128 v = _mm_loadu_ps(src + i);
+    const unsigned int mask = _mm_movemask_ps(_mm_cmpgt_ps(v, t));
+    if (mask) top_k_mask(mask, src, i, k, min_score, heap);
+  }
+  top_k_scan_scalar(src, n, k, min_score, i, heap);
+}
+
+ST_TARGET("avx2")
+inline void top_k_scan_avx2(const float* src, int n, size_t k, float min_score,
+                            std::vector<scored_index>& heap) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 t = _mm256_set1_ps(top_k_floor(heap, k, min_score));
+    const __m256 v = _mm256_loadu_ps(src + i);
+    const unsigned int mask =
+        _mm256_movemask_ps(_mm256_cmp_ps(v, t, _CMP_GT_OQ));
+    if (mask) top_k_mask(mask, src, i, k, min_score, heap);
+  }
+  top_k_scan_scalar(src, n, k, min_score, i, heap);
+}
+
+ST_TARGET("avx512f")
+inline void top_k_scan_avx512(const float* src, int n, size_t k,
+                              float min_score,
+                              std::vector<scored_index>& heap) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m512 t = _mm512_set1_ps(top_k_floor(heap, k, min_score));
+    const __m512 v = _mm512_loadu_ps(src + i);
+    const unsigned int mask = _mm512_cmp_ps_mask(v, t, _CMP_GT_OQ);
+    if (mask) top_k_mask(mask, src, i, k, min_score, heap);
+  }
+  top_k_scan_scalar(src, n, k, min_score, i, heap);
+}
+
+// exp(x) for x <= 0 with the polynomial of the cephes expf, the result is
+// flushed to zero below -87
+ST_TARGET("sse4.1")
+inline __m128 exp_sse4(__m128 x) {
+  x = _mm_max_ps(x, _mm_set1_ps(-87.f));
+  // x = n * ln2 + r, |r| <= ln2 / 2
+  const __m128 n = _mm_floor_ps(
+      _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)), _mm_set1_ps(0.5f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+  __m128 y = _mm_set1_ps(1.9875691500e-4f);
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+  y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+  y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)),
+                 _mm_add_ps(x, _mm_set1_ps(1.f)));
+  // 2^n built in the exponent field
+  const __m128i e = _mm_slli_epi32(
+      _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(y, _mm_castsi128_ps(e));
+}
+
+ST_TARGET("sse4.1")
+inline float exp_sum_sse4(const float* src, int n, float max, float scale) {
+  const __m128 m = _mm_set1_ps(max);
+  const __m128 s = _mm_set1_ps(scale);
+  __m128 acc = _mm_setzero_ps();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m128 x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + i), m), s);
+    acc = _mm_add_ps(acc, exp_sse4(x));
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         exp_sum_scalar(src, n, max, scale, i);
+}
+
+ST_TARGET("avx2")
+inline __m256 exp_avx2(__m256 x) {
+  x = _mm256_max_ps(x, _mm256_set1_ps(-87.f));
+  const __m256 n = _mm256_floor_ps(_mm256_add_ps(
+      _mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _mm256_set1_ps(0.5f)));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(0.693359375f)));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(-2.12194440e-4f)));
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(x, x)),
+                    _mm256_add_ps(x, _mm256_set1_ps(1.f)));
+  const __m256i e = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+ST_TARGET("avx2")
+inline float exp_sum_avx2(const float* src, int n, float max, float scale) {
+  const __m256 m = _mm256_set1_ps(max);
+  const __m256 s = _mm256_set1_ps(scale);
+  __m256 acc = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 x =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + i), m), s);
+    acc = _mm256_add_ps(acc, exp_avx2(x));
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, acc);
+  float sum = 0.f;
+  for (int l = 0; l < 8; ++l) sum += lanes[l];
+  return sum + exp_sum_scalar(src, n, max, scale, i);
+}
+#endif  // ST_SIMD_X86
+
+}  // namespace postprocess
+
+/**
+ * @brief Find the values that are not below a threshold
+ * @details Most values of a score map are far below the threshold, the scan
+ * compares a whole vector at once and only the hits are looked at one by one.
+ * @param src scores
+ * @param n number of scores
+ * @param threshold
+ * @param hits indices of the hits are appended to it, in increasing order
+ */
+inline void threshold_scan(const float* src, int n, float threshold,
+                           std::vector<int>& hits) {
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+      return postprocess::threshold_scan_avx512(src, n, threshold, hits);
+    case simd::isa::AVX2:
+      return postprocess::threshold_scan_avx2(src, n, threshold, hits);
+    case simd::isa::SSE4:
+      return postprocess::threshold_scan_sse4(src, n, threshold, hits);
+    default:
+      break;
+  }
+#endif
+  postprocess::threshold_scan_scalar(src, n, threshold, 0, hits);
+}
+
+/**
+ * @brief Whether a box overlaps any of the boxes more than a threshold
+ * @details The test is intersection > threshold * union, which is the same as
+ * IoU > threshold without the division.
+ * @param boxes
+ * @param b
+ * @param threshold IoU threshold
+ * @return true if one IoU is above the threshold
+ */
+inline bool iou_any_above(const box_columns& boxes, const area_box& b,
+                          float threshold) {
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+    case simd::isa::AVX2:
+      return postprocess::iou_any_above_avx2(boxes, b, threshold);
+    case simd::isa::SSE4:
+      return postprocess::iou_any_above_sse4(boxes, b, threshold);
+    default:
+      break;
+  }
+#endif
+  return postprocess::iou_any_above_scalar(boxes, 0, b, threshold);
+}
+
+/**
+ * @brief IoU of a box with each of the boxes
+ *
+ * @param boxes
+ * @param b
+ * @param iou boxes.size() values
+ */
+inline void iou_row(const box_columns& boxes, const area_box& b, float* iou) {
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+    case simd::isa::AVX2:
+      return postprocess::iou_row_avx2(boxes, b, iou);
+    case simd::isa::SSE4:
+      return postprocess::iou_row_sse4(boxes, b, iou);
+    default:
+      break;
+  }
+#endif
+  postprocess::iou_row_scalar(boxes, 0, b, iou);
+}
+
+/**
+ * @brief Select the k best scores
+ * @details One pass over the scores with a heap of k entries. The scores are
+ * compared a whole vector at once with the worst score of the heap, which
+ * leaves most of them out once the heap is full, so the cost is about a linear
+ * scan instead of sorting all the scores.
+ * @param src scores
+ * @param n number of scores
+ * @param k number of scores to select
+ * @param min_score only the scores above it are selected
+ * @param top the selected scores and their indices, by decreasing score then
+ * increasing index
+ */
+inline void top_k_scores(const float* src, int n, int k, float min_score,
+                         std::vector<postprocess::scored_index>& top) {
+  top.clear();
+  if (k <= 0) return;
+  const size_t kk = static_cast<size_t>(k);
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+      postprocess::top_k_scan_avx512(src, n, kk, min_score, top);
+      break;
+    case simd::isa::AVX2:
+      postprocess::top_k_scan_avx2(src, n, kk, min_score, top);
+      break;
+    case simd::isa::SSE4:
+      postprocess::top_k_scan_sse4(src, n, kk, min_score, top);
+      break;
+    default:
+      postprocess::top_k_scan_scalar(src, n, kk, min_score, 0, top);
+      break;
+  }
+#else
+  postprocess::top_k_scan_scalar(src, n, kk, min_score, 0, top);
+#endif
+  std::sort_heap(top.begin(), top.end(), postprocess::score_better);
+}
+
+/**
+ * @brief Denominator of a softmax with temperature
+ * @details Sum of exp((x - max) * scale) over the scores, with a polynomial
+ * exp on 4 or 8 scores at once. The probability of a score x is then
+ * exp((x - max) * scale) / sum.
+ * @param src scores
+ * @param n number of scores
+ * @param max largest score, so that no exponent is positive
+ * @param scale inverse of the temperature
+ * @return float
+ */
+inline float exp_sum(const float* src, int n, float max, float scale) {
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+    case simd::isa::AVX2:
+      return postprocess::exp_sum_avx2(src, n, max, scale);
+    case simd::isa::SSE4:
+      return postprocess::exp_sum_sse4(src, n, max, scale);
+    default:
+      break;
+  }
+#endif
+  return postprocess::exp_sum_scalar(src, n, max, scale, 0);
+}
+
+}  // namespace ie
+}  // namespace st
@@ -0,0 +1,640 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the image preprocessing kernels shared by the
+ * inference engines: resize, HWC -> CHW deinterleave, u8 -> fp32/fp16
+ * normalization and BGR <-> RGB swap
+ ***************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "st_simd.h"
+
+namespace st {
+namespace ie {
+
+/**
+ * @brief Layout of the destination tensor of one image
+ *
+ */
+enum class pixel_layout {
+  CHW,  //!< planar, e.g. OpenVino NCHW blobs
+  HWC   //!< interleaved, e.g. TensorRT NHWC buffers
+};
+
+/**
+ * @brief Normalization of the pixel values, dst = scale * src + bias
+ * @details Must be the identity for 8-bit destinations
+ */
+struct normalization {
+  float scale;
+  float bias;
+};
+
+/**
+ * @brief Raw bits of an IEEE half precision float, layout compatible with
+ * half_float::half
+ */
+using fp16_t = std::uint16_t;
+
+namespace preprocess {
+/**
+ * @brief Convert a float to half precision, round to nearest even
+ *
+ * @param value
+ * @return fp16_t
+ */
+inline fp16_t float_to_half(float value) {
+  const std::uint32_t f32_infinity = 255u << 23;
+  const std::uint32_t f16_max = (127u + 16u) << 23;
+  const std::uint32_t denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+  std::uint32_t f;
+  std::memcpy(&f, &value, sizeof(f));
+  const std::uint32_t sign = f & 0x80000000u;
+  f ^= sign;
+  std::uint32_t o;
+  if (f >= f16_max) {
+    // overflow to infinity, keep nan
+    o = (f > f32_infinity) ? 0x7e00 : 0x7c00;
+  } else if (f < (113u << 23)) {
+    // subnormal, let the fpu do the rounding
+    float magic, ff;
+    std::memcpy(&magic, &denorm_magic, sizeof(magic));
+    std::memcpy(&ff, &f, sizeof(ff));
+    ff += magic;
+    std::memcpy(&o, &ff, sizeof(o));
+    o -= denorm_magic;
+  } else {
+    const std::uint32_t mant_odd = (f >> 13) & 1;
+    f += (static_cast<std::uint32_t>(15 - 127) << 23) + 0xfff;
+    f += mant_odd;
+    o = f >> 13;
+  }
+  return static_cast<fp16_t>(o | (sign >> 16));
+}
+
+/****************************************************************/
+/*  Scalar kernels                                              */
+/****************************************************************/
+
+template <typename T>
+inline T convert_pixel(std::uint8_t x, float scale, float bias) {
+  return static_cast<T>(scale * x + bias);
+}
+template <>
+inline std::uint8_t convert_pixel<std::uint8_t>(std::uint8_t x, float, float) {
+  return x;
+}
+template <>
+inline fp16_t convert_pixel<fp16_t>(std::uint8_t x, float scale, float bias) {
+  return float_to_half(scale * x + bias);
+}
+
+// deinterleave one row of 3-channel pixels into 3 planes
+template <typename T>
+inline void chw_row_scalar(const std::uint8_t* src, int w, T* p0, T* p1,
+                           T* p2, float scale, float bias) {
+  for (int x = 0; x < w; ++x) {
+    p0[x] = convert_pixel<T>(src[3 * x + 0], scale, bias);
+    p1[x] = convert_pixel<T>(src[3 * x + 1], scale, bias);
+    p2[x] = convert_pixel<T>(src[3 * x + 2], scale, bias);
+  }
+}
+
+// convert n contiguous values
+template <typename T>
+inline void span_scalar(const std::uint8_t* src, size_t n, T* dst, float scale,
+                        float bias) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = convert_pixel<T>(src[i], scale, bias);
+  }
+}
+
+// convert one row of 3-channel pixels, swapping the first and last channel
+template <typename T>
+inline void hwc_swap_row_scalar(const std::uint8_t* src, int w, T* dst,
+                                float scale, float bias) {
+  for (int x = 0; x < w; ++x) {
+    dst[3 * x + 0] = convert_pixel<T>(src[3 * x + 2], scale, bias);
+    dst[3 * x + 1] = convert_pixel<T>(src[3 * x + 1], scale, bias);
+    dst[3 * x + 2] = convert_pixel<T>(src[3 * x + 0], scale, bias);
+  }
+}
+
+#if ST_SIMD_X86
+/****************************************************************/
+/*  SSE4 kernels                                                */
+/****************************************************************/
+
+// deinterleave 16 3-channel pixels (48 bytes) into 3 registers
+ST_TARGET("ssse3,sse4.1")
+inline void deinterleave16(const std::uint8_t* src, __m128i& c0, __m128i& c1,
+                           __m128i& c2) {
+  const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+  const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+  c0 = _mm_or_si128(
+      _mm_or_si128(
+          _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1)),
+          _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8,
+                                            11, 14, -1, -1, -1, -1, -1))),
+      _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, 1, 4, 7, 10, 13)));
+  c1 = _mm_or_si128(
+      _mm_or_si128(
+          _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1)),
+          _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9,
+                                            12, 15, -1, -1, -1, -1, -1))),
+      _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, 2, 5, 8, 11, 14)));
+  c2 = _mm_or_si128(
+      _mm_or_si128(
+          _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1)),
+          _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10,
+                                            13, -1, -1, -1, -1, -1, -1))),
+      _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, 0, 3, 6, 9, 12, 15)));
+}
+
+ST_TARGET("ssse3,sse4.1")
+inline __m128 cvt4_sse4(__m128i v, __m128 s, __m128 b) {
+  return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(v)), s), b);
+}
+// store 16 u8 values to the destination
+ST_TARGET("ssse3,sse4.1")
+inline void store16_sse4(std::uint8_t* dst, __m128i v, __m128, __m128) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+}
+ST_TARGET("ssse3,sse4.1")
+inline void store16_sse4(float* dst, __m128i v, __m128 s, __m128 b) {
+  _mm_storeu_ps(dst + 0, cvt4_sse4(v, s, b));
+  _mm_storeu_ps(dst + 4, cvt4_sse4(_mm_srli_si128(v, 4), s, b));
+  _mm_storeu_ps(dst + 8, cvt4_sse4(_mm_srli_si128(v, 8), s, b));
+  _mm_storeu_ps(dst + 12, cvt4_sse4(_mm_srli_si128(v, 12), s, b));
+}
+ST_TARGET("ssse3,sse4.1")
+inline void store16_sse4(fp16_t* dst, __m128i v, __m128 s, __m128 b) {
+  // no F16C at this level
+  float tmp[16];
+  store16_sse4(tmp, v, s, b);
+  for (int i = 0; i < 16; ++i) dst[i] = float_to_half(tmp[i]);
+}
+
+template <typename T>
+ST_TARGET("ssse3,sse4.1")
+inline void chw_row_sse4(const std::uint8_t* src, int w, T* p0, T* p1, T* p2,
+                         float scale, float bias) {
+  const __m128 s = _mm_set1_ps(scale), b = _mm_set1_ps(bias);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m128i c0, c1, c2;
+    deinterleave16(src + 3 * x, c0, c1, c2);
+    store16_sse4(p0 + x, c0, s, b);
+    store16_sse4(p1 + x, c1, s, b);
+    store16_sse4(p2 + x, c2, s, b);
+  }
+  chw_row_scalar(src + 3 * x, w - x, p0 + x, p1 + x, p2 + x, scale, bias);
+}
+
+template <typename T>
+ST_TARGET("ssse3,sse4.1")
+inline void span_sse4(const std::uint8_t* src, size_t n, T* dst, float scale,
+                      float bias) {
+  const __m128 s = _mm_set1_ps(scale), b = _mm_set1_ps(bias);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    store16_sse4(dst + i,
+                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),
+                 s, b);
+  }
+  span_scalar(src + i, n - i, dst + i, scale, bias);
+}
+
+/****************************************************************/
+/*  AVX2 kernels                                                */
+/****************************************************************/
+
+ST_TARGET("avx2,f16c")
+inline __m256 cvt8_avx2(__m128i v, __m256 s, __m256 b) {
+  return _mm256_add_ps(
+      _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)), s), b);
+}
+ST_TARGET("avx2,f16c")
+inline void store16_avx2(std::uint8_t* dst, __m128i v, __m256, __m256) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+}
+ST_TARGET("avx2,f16c")
+inline void store16_avx2(float* dst, __m128i v, __m256 s, __m256 b) {
+  _mm256_storeu_ps(dst + 0, cvt8_avx2(v, s, b));
+  _mm256_storeu_ps(dst + 8, cvt8_avx2(_mm_srli_si128(v, 8), s, b));
+}
+ST_TARGET("avx2,f16c")
+inline void store16_avx2(fp16_t* dst, __m128i v, __m256 s, __m256 b) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 0),
+                   _mm256_cvtps_ph(cvt8_avx2(v, s, b), _MM_FROUND_TO_NEAREST_INT));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 8),
+                   _mm256_cvtps_ph(cvt8_avx2(_mm_srli_si128(v, 8), s, b),
+                                   _MM_FROUND_TO_NEAREST_INT));
+}
+
+template <typename T>
+ST_TARGET("avx2,f16c")
+inline void chw_row_avx2(const std::uint8_t* src, int w, T* p0, T* p1, T* p2,
+                         float scale, float bias) {
+  const __m256 s = _mm256_set1_ps(scale), b = _mm256_set1_ps(bias);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m128i c0, c1, c2;
+    deinterleave16(src + 3 * x, c0, c1, c2);
+    store16_avx2(p0 + x, c0, s, b);
+    store16_avx2(p1 + x, c1, s, b);
+    store16_avx2(p2 + x, c2, s, b);
+  }
+  chw_row_scalar(src + 3 * x, w - x, p0 + x, p1 + x, p2 + x, scale, bias);
+}
+
+template <typename T>
+ST_TARGET("avx2,f16c")
+inline void span_avx2(const std::uint8_t* src, size_t n, T* dst, float scale,
+                      float bias) {
+  const __m256 s = _mm256_set1_ps(scale), b = _mm256_set1_ps(bias);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    store16_avx2(dst + i,
+                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),
+                 s, b);
+  }
+  span_scalar(src + i, n - i, dst + i, scale, bias);
+}
+
+/****************************************************************/
+/*  AVX-512 kernels                                             */
+/****************************************************************/
+
+// the zero-masked conversions avoid the _mm512_undefined_* pass-through that
+// some GCC versions report as maybe-uninitialized. The normalization is fused,
+// so fp32 results may differ from the other levels by 1 ulp
+ST_TARGET("avx512f")
+inline __m512 cvt16_avx512(__m128i v, __m512 s, __m512 b) {
+  const __mmask16 all = 0xffff;
+  return _mm512_fmadd_ps(
+      _mm512_maskz_cvtepi32_ps(all, _mm512_maskz_cvtepu8_epi32(all, v)), s, b);
+}
+ST_TARGET("avx512f")
+inline void store16_avx512(std::uint8_t* dst, __m128i v, __m512, __m512) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+}
+ST_TARGET("avx512f")
+inline void store16_avx512(float* dst, __m128i v, __m512 s, __m512 b) {
+  _mm512_storeu_ps(dst, cvt16_avx512(v, s, b));
+}
+ST_TARGET("avx512f")
+inline void store16_avx512(fp16_t* dst, __m128i v, __m512 s, __m512 b) {
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                      _mm512_maskz_cvtps_ph(0xffff, cvt16_avx512(v, s, b),
+                                            _MM_FROUND_TO_NEAREST_INT));
+}
+
+template <typename T>
+ST_TARGET("avx512f")
+inline void chw_row_avx512(const std::uint8_t* src, int w, T* p0, T* p1,
+                           T* p2, float scale, float bias) {
+  const __m512 s = _mm512_set1_ps(scale), b = _mm512_set1_ps(bias);
+  int x = 0;
+  for (; x + 16 <= w; x += 16) {
+    __m128i c0, c1, c2;
+    deinterleave16(src + 3 * x, c0, c1, c2);
+    store16_avx512(p0 + x, c0, s, b);
+    store16_avx512(p1 + x, c1, s, b);
+    store16_avx512(p2 + x, c2, s, b);
+  }
+  chw_row_scalar(src + 3 * x, w - x, p0 + x, p1 + x, p2 + x, scale, bias);
+}
+
+template <typename T>
+ST_TARGET("avx512f")
+inline void span_avx512(const std::uint8_t* src, size_t n, T* dst, float scale,
+                        float bias) {
+  const __m512 s = _mm512_set1_ps(scale), b = _mm512_set1_ps(bias);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    store16_avx512(dst + i,
+                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)),
+                   s, b);
+  }
+  span_scalar(src + i, n - i, dst + i, scale, bias);
+}
+#endif  // ST_SIMD_X86
+
+/****************************************************************/
+/*  Dispatch                                                    */
+/****************************************************************/
+
+// destination types that have SIMD kernels, the others run the scalar ones
+template <typename T>
+struct has_simd_kernel : std::false_type {};
+template <>
+struct has_simd_kernel<std::uint8_t> : std::true_type {};
+template <>
+struct has_simd_kernel<float> : std::true_type {};
+template <>
+struct has_simd_kernel<fp16_t> : std::true_type {};
+
+template <typename T>
+inline void chw_row(const std::uint8_t* src, int w, T* p0, T* p1, T* p2,
+                    float scale, float bias, std::false_type) {
+  chw_row_scalar(src, w, p0, p1, p2, scale, bias);
+}
+template <typename T>
+inline void chw_row(const std::uint8_t* src, int w, T* p0, T* p1, T* p2,
+                    float scale, float bias, std::true_type) {
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+      return chw_row_avx512(src, w, p0, p1, p2, scale, bias);
+    case simd::isa::AVX2:
+      return chw_row_avx2(src, w, p0, p1, p2, scale, bias);
+    case simd::isa::SSE4:
+      return chw_row_sse4(src, w, p0, p1, p2, scale, bias);
+    default:
+      break;
+  }
+#endif
+  chw_row_scalar(src, w, p0, p1, p2, scale, bias);
+}
+
+template <typename T>
+inline void span(const std::uint8_t* src, size_t n, T* dst, float scale,
+                 float bias, std::false_type) {
+  span_scalar(src, n, dst, scale, bias);
+}
+template <typename T>
+inline void span(const std::uint8_t* src, size_t n, T* dst, float scale,
+                 float bias, std::true_type) {
+#if ST_SIMD_X86
+  switch (simd::best_isa()) {
+    case simd::isa::AVX512:
+      return span_avx512(src, n, dst, scale, bias);
+    case simd::isa::AVX2:
+      return span_avx2(src, n, dst, scale, bias);
+    case simd::isa::SSE4:
+      return span_sse4(src, n, dst, scale, bias);
+    default:
+      break;
+  }
+#endif
+  span_scalar(src, n, dst, scale, bias);
+}
+
+/****************************************************************/
+/*  Resize                                                      */
+/****************************************************************/
+
+const int resize_coef_bits = 11;  //!< fixed point precision of the weights
+
+/**
+ * @brief Bilinear sampling table of one axis
+ * @details Same pixel center convention as cv::resize with INTER_LINEAR
+ */
+struct resize_table {
+  std::vector<int> ofs0;  //!< first source index
+  std::vector<int> ofs1;  //!< second source index
+  std::vector<int> wgt;   //!< weight of the second source index
+  void build(int src_size, int dst_size, int stride) {
+    ofs0.resize(dst_size);
+    ofs1.resize(dst_size);
+    wgt.resize(dst_size);
+    const float ratio = static_cast<float>(src_size) / dst_size;
+    for (int i = 0; i < dst_size; ++i) {
+      float f = (i + 0.5f) * ratio - 0.5f;
+      int k = static_cast<int>(std::floor(f));
+      f -= k;
+      if (k < 0) {
+        k = 0;
+        f = 0;
+      }
+      if (k >= src_size - 1) {
+        k = src_size - 1;
+        f = 0;
+      }
+      ofs0[i] = k * stride;
+      ofs1[i] = std::min(k + 1, src_size - 1) * stride;
+      wgt[i] = static_cast<int>(f * (1 << resize_coef_bits) + 0.5f);
+    }
+  }
+};
+
+/**
+ * @brief Horizontal pass, sample one source row at the destination width
+ *
+ * @param src source row
+ * @param xt horizontal table, offsets in bytes
+ * @param dst fixed point row, 3 values per pixel
+ */
+inline void resize_hrow(const std::uint8_t* src, const resize_table& xt,
+                        int* dst) {
+  const int one = 1 << resize_coef_bits;
+  const int w = static_cast<int>(xt.wgt.size());
+  for (int x = 0; x < w; ++x) {
+    const std::uint8_t* a = src + xt.ofs0[x];
+    const std::uint8_t* b = src + xt.ofs1[x];
+    const int wx = xt.wgt[x];
+    dst[3 * x + 0] = a[0] * (one - wx) + b[0] * wx;
+    dst[3 * x + 1] = a[1] * (one - wx) + b[1] * wx;
+    dst[3 * x + 2] = a[2] * (one - wx) + b[2] * wx;
+  }
+}
+
+/**
+ * @brief Vertical pass, blend two horizontal rows into a u8 row
+ *
+ * @param h0 upper row
+ * @param h1 lower row
+ * @param wy weight of the lower row
+ * @param n number of values
+ * @param dst
+ */
+inline void resize_vrow_scalar(const int* h0, const int* h1, int wy, int n,
+                               std::uint8_t* dst) {
+  const int one = 1 << resize_coef_bits;
+  const int shift = 2 * resize_coef_bits;
+  const int round = 1 << (shift - 1);
+  for (int i = 0; i < n; ++i) {
+    dst[i] =
+        static_cast<std::uint8_t>((h0[i] * (one - wy) + h1[i] * wy + round) >> shift);
+  }
+}
+#if ST_SIMD_X86
+ST_TARGET("ssse3,sse4.1")
+inline void resize_vrow_sse4(const int* h0, const int* h1, int wy, int n,
+                             std::uint8_t* dst) {
+  const int one = 1 << resize_coef_bits;
+  const int shift = 2 * resize_coef_bits;
+  const __m128i w0 = _mm_set1_epi32(one - wy), w1 = _mm_set1_epi32(wy);
+  const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v[4];
+    for (int k = 0; k < 4; ++k) {
+      const __m128i a =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(h0 + i + 4 * k));
+      const __m128i b =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(h1 + i + 4 * k));
+      v[k] = _mm_srli_epi32(
+          _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(a, w0),
+                                      _mm_mullo_epi32(b, w1)),
+                        round),
+          shift);
+    }
+    const __m128i lo = _mm_packus_epi32(v[0], v[1]);
+    const __m128i hi = _mm_packus_epi32(v[2], v[3]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(lo, hi));
+  }
+  resize_vrow_scalar(h0 + i, h1 + i, wy, n - i, dst + i);
+}
+#endif
+
+inline void resize_vrow(const int* h0, const int* h1, int wy, int n,
+                        std::uint8_t* dst) {
+#if ST_SIMD_X86
+  if (simd::best_isa() >= simd::isa::SSE4) {
+    return resize_vrow_sse4(h0, h1, wy, n, dst);
+  }
+#endif
+  resize_vrow_scalar(h0, h1, wy, n, dst);
+}
+
+/**
+ * @brief Bilinear resize of a 3-channel image, one destination row at a time
+ * @details The two horizontal rows are cached, so that consecutive
+ * destination rows sampling the same source rows (upscaling) do the
+ * horizontal pass once
+ */
+class row_resizer {
+ public:
+  void init(const cv::Mat& src, int width, int height) {
+    image = &src;
+    xt.build(src.cols, width, 3);
+    yt.build(src.rows, height, 1);
+    n = 3 * width;
+    hrows[0].resize(n);
+    hrows[1].resize(n);
+    cached[0] = cached[1] = -1;
+    row.resize(n);
+  }
+  const std::uint8_t* operator()(int y) {
+    const int* h0 = hrow(yt.ofs0[y]);
+    const int* h1 = hrow(yt.ofs1[y]);
+    resize_vrow(h0, h1, yt.wgt[y], n, row.data());
+    return row.data();
+  }
+
+ private:
+  const int* hrow(int sy) {
+    for (int k = 0; k < 2; ++k) {
+      if (cached[k] == sy) return hrows[k].data();
+    }
+    // replace the row that is not the other input of the current blend,
+    // source rows are visited in increasing order
+    const int k = cached[0] < cached[1] ? 0 : 1;
+    resize_hrow(image->ptr<std::uint8_t>(sy), xt, hrows[k].data());
+    cached[k] = sy;
+    return hrows[k].data();
+  }
+  const cv::Mat* image = nullptr;
+  resize_table xt, yt;
+  int n = 0;
+  std::vector<int> hrows[2];  //!< horizontal rows
+  int cached[2];              //!< source row of each horizontal row
+  std::vector<std::uint8_t> row;
+};
+}  // namespace preprocess
+
+/**
+ * @brief Convert an image of any depth to 8 bits, with the same channels
+ * @details 16-bit images are scaled by 1/257, so that 65535 maps to 255,
+ * floating point images are assumed to be in [0, 1]. Other depths saturate.
+ * @param image
+ * @return cv::Mat image itself if it is already 8-bit
+ */
+inline cv::Mat to_8bit(const cv::Mat& image) {
+  if (image.depth() == CV_8U) return image;
+  double scale = 1;
+  if (image.depth() == CV_16U) {
+    scale = 1. / 257;
+  } else if (image.depth() == CV_32F || image.depth() == CV_64F) {
+    scale = 255;
+  }
+  cv::Mat ret;
+  image.convertTo(ret, CV_8U, scale);
+  return ret;
+}
+
+/**
+ * @brief Resize a BGR image and write it into a tensor
+ * @details Each destination row is sampled from the source (bilinear, when
+ * the sizes differ) into a row buffer, then converted straight into the
+ * destination by the best SIMD kernel of the CPU. No intermediate image is
+ * created for 8-bit 3-channel input.
+ * @tparam T destination type: uint8_t, float, fp16_t or any arithmetic type
+ * @param image gray, BGR or BGRA image, converted to 8-bit BGR first, see
+ * to_8bit
+ * @param width width of the destination
+ * @param height height of the destination
+ * @param dst destination, 3 * width * height values
+ * @param layout layout of the destination
+ * @param norm normalization, must be the identity for uint8_t
+ * @param swap_rb write the channels in RGB order
+ */
+template <typename T>
+void resize_convert(const cv::Mat& image, int width, int height, T* dst,
+                    pixel_layout layout, normalization norm = {1.f, 0.f},
+                    bool swap_rb = false) {
+  assert((!std::is_same<T, std::uint8_t>::value ||
+          (norm.scale == 1.f && norm.bias == 0.f)));
+  cv::Mat bgr = to_8bit(image);
+  if (bgr.channels() != 3) {
+    cv::cvtColor(bgr, bgr,
+                 bgr.channels() == 1 ? cv::COLOR_GRAY2BGR : cv::COLOR_BGRA2BGR);
+  }
+  const bool resize = bgr.cols != width || bgr.rows != height;
+  // per-thread buffers so that nothing is allocated in steady state
+  thread_local preprocess::row_resizer resizer;
+  if (resize) resizer.init(bgr, width, height);
+  const size_t plane = static_cast<size_t>(width) * height;
+  const preprocess::has_simd_kernel<T> tag{};
+  for (int y = 0; y < height; ++y) {
+    const std::uint8_t* row =
+        resize ? resizer(y) : bgr.ptr<std::uint8_t>(y);
+    if (layout == pixel_layout::CHW) {
+      T* p0 = dst + y * static_cast<size_t>(width);
+      T* p1 = p0 + plane;
+      T* p2 = p1 + plane;
+      if (swap_rb) std::swap(p0, p2);
+      preprocess::chw_row(row, width, p0, p1, p2, norm.scale, norm.bias, tag);
+    } else if (swap_rb) {
+      preprocess::hwc_swap_row_scalar(row, width,
+                                      dst + 3 * y * static_cast<size_t>(width),
+                                      norm.scale, norm.bias);
+    } else {
+      preprocess::span(row, 3 * static_cast<size_t>(width),
+                       dst + 3 * y * static_cast<size_t>(width), norm.scale,
+                       norm.bias, tag);
+    }
+  }
+}
+
+}  // namespace ie
+}  // namespace st
@@ -19,6 +19,7 @@
 #include "st_ie_base.h"
 #include "st_ie_buffer.h"
 #include "st_ie_common.h"
+#include "st_ie_decode.h"
 #include "st_logging.h"
 
 using namespace nvinfer1;
@@ -42,21 +43,25 @@ public:
   /*       Implement of inference engine public interface   */
   /**********************************************************/
 
-  std::vector<bbox> run_detection(const char* data, int size) final {
-    auto iobuf = do_infer(data,size);
-    return detection_parser(std::move(iobuf));
+  void run_detection(
+      const char* data, int size, detection_result& result,
+      const inference_params& params = inference_params()) final {
+    reset_result(result);
+    auto iobuf = do_infer(data, size, params.input);
+    if (!iobuf) return;
+    detection_parser(std::move(iobuf), params, result);
   }
 
   /**
    * @brief Parse the output detection network
    * 
    * @param iobuf 
-   * @return std::vector<bbox> 
+   * @param params options of the request
+   * @param result where the boxes are appended
    */
-  virtual std::vector<bbox> detection_parser(
-      std::unique_ptr<buffer_manager>&& iobuf) {
-    return {};
-  }
+  virtual void detection_parser(std::unique_ptr<buffer_manager>&& iobuf,
+                                const inference_params& params,
+                                detection_result& result) {}
 
   using ptr = std::shared_ptr<tensorrt_inference_engine>;
 
@@ -94,12 +99,14 @@ protected:
   /**
    * @brief Do the inference with the cuda engine
    * 
-   * @param data JPEG data buffer
+   * @param data JPEG data buffer, or raw frame
    * @param size Size of the buffer
+   * @param format format of the data
    * @return std::unique_ptr<buffer_manager> The buffer mng that hold the 
    * I/O buffer after running inference
    */
-  virtual std::unique_ptr<buffer_manager> do_infer(const char* data, int size) {
+  virtual std::unique_ptr<buffer_manager> do_infer(const char* data, int size,
+                                                   const image_format& format) {
     try {
       // create execution context with memory allocation for all
       // activations (laten features)
@@ -109,11 +116,24 @@ protected:
       std::chrono::duration<double, std::milli> elapsed_mil;
 
       start = std::chrono::system_clock::now();
-      cv::Mat frame =
-          cv::imdecode(cv::Mat(1, size, CV_8UC3, (unsigned char*)data),
-                        cv::IMREAD_UNCHANGED);
-      const int width = frame.size().width;
-      const int height = frame.size().height;
+      // large JPEG images are decoded at a reduced resolution that is still
+      // larger than the network input (HWC dimensions)
+      int input_width = 0, input_height = 0;
+      for (int ix = 0; ix < engine->getNbBindings(); ++ix) {
+        if (engine->bindingIsInput(ix)) {
+          Dims dim = context->getBindingDimensions(ix);
+          input_height = dim.d[0];
+          input_width = dim.d[1];
+          break;
+        }
+      }
+      cv::Size original;
+      cv::Mat frame = load_image(data, size, format, input_width,
+                                 input_height, &original);
+      // not an image, or a raw frame that doesn't match its format
+      if (frame.empty()) return {};
+      const int width = original.width;
+      const int height = original.height;
       end = std::chrono::system_clock::now();
       elapsed_mil = end - start;
       trt_log->debug("Decode image in {} ms", elapsed_mil.count());
@@ -163,57 +183,38 @@ public:
     build_engine(serialized_model);
     set_labels(label);
   }
-  std::vector<bbox> detection_parser (std::unique_ptr<buffer_manager>&& _iobuf) final {
+  void detection_parser(std::unique_ptr<buffer_manager>&& _iobuf,
+                        const inference_params& params,
+                        detection_result& result) final {
     trt_log->debug("Parsing ssd output");
     std::chrono::time_point<std::chrono::system_clock> start;
     std::chrono::time_point<std::chrono::system_clock> end;
     std::chrono::duration<double, std::milli> elapsed_mil;
     start = std::chrono::system_clock::now();  // sync mode only
     auto iobuf = std::move(_iobuf);
-    std::vector<bbox> ret;
     // get the right output
     int ix = 0;
     for (ix = 0; ix < engine->getNbBindings(); ++ix) {
       if (!engine->bindingIsInput(ix) && engine->getBindingDimensions(ix).d[2] == 7) break;
     }
+    if (ix == engine->getNbBindings()) {
+      trt_log->error("No output with 7 values per detection");
+      return;
+    }
     float* detections = (float*) iobuf->get_buffer(true,ix);
     auto dims = engine->getBindingDimensions(ix);
     const int maxProposalCount = dims.d[1];
-    const int objectSize = dims.d[2];
-    trt_log->trace("TopK {}, object size {}", maxProposalCount, objectSize);    
+    trt_log->trace("TopK {}, object size {}", maxProposalCount, dims.d[2]);
     auto sz = iobuf->get_im_size();
-    const int width = sz.first, height = sz.second;
-    for (int i = 0; i < maxProposalCount; i++) {
-      float image_id = detections[i * objectSize + 0];
-      if (image_id < 0) {
-        break;
-      }
-      float confidence = detections[i * objectSize + 2];
-      auto label_id = static_cast<int>(detections[i * objectSize + 1]);
-      if (label_id <= 0) break;
-      int xmin = detections[i * objectSize + 3] * width;
-      int ymin = detections[i * objectSize + 4] * height;
-      int xmax = detections[i * objectSize + 5] * width;
-      int ymax = detections[i * objectSize + 6] * height;
-      trt_log->trace("{} {} {} {} {} {} {} {}", i, image_id, label_id, confidence, xmin, ymin, xmax, ymax);
-      auto label = labels[label_id-1];
-      trt_log->trace("Object: {}", label);
-      if (confidence > 0.45) {
-        bbox d;
-        d.prop = confidence;
-        d.label_id = label_id;
-        d.label = label;
-        d.c[0] = xmin;
-        d.c[1] = ymin;
-        d.c[2] = xmax;
-        d.c[3] = ymax;
-        ret.push_back(d);
-      }
-    }
+    thread_local detection_columns boxes;
+    // the engine runs one image at a time
+    parse_detection_output<7, ssd_rows>(detections, maxProposalCount, 0,
+                                        params.min_confidence_or(0.45f),
+                                        sz.first, sz.second, boxes);
+    append_boxes(boxes, result);
     end = std::chrono::system_clock::now();  // sync mode only
     elapsed_mil = end - start;
     trt_log->debug("Parsing network output in {} ms", elapsed_mil.count());
-    return ret;
   }
 };
 
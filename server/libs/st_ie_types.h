@@ -0,0 +1,392 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the types shared by the inference engines and
+ * the workers, the predictions, the options of a request and the task queue,
+ * without any dependency on OpenVino, TensorRT or OpenCV
+ ***************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "st_dispatcher.h"
+#include "st_json_writer.h"
+#include "st_message_queue.h"
+
+namespace st {
+namespace ie {
+/**
+ * @brief Bouding box object
+ * @details Basic bouding box object that can use in any recognition task. The
+ * box is a plain struct, the name of the label is kept in the label_table of
+ * the engine and is only looked up when the result is written to the client.
+ */
+struct bbox {
+  int label_id;  //!< label id, the first label is 1
+  float prop;    //!< confidence score
+  float c[4];    //!< xmin, ymin, xmax, ymax, all zero for classification
+};
+
+/**
+ * @brief Names of the labels of a model, one per line of the label file
+ * @details The table is loaded once per file and shared by all the engines
+ * and the results that use it.
+ */
+class label_table {
+ public:
+  using ptr = std::shared_ptr<const label_table>;
+  /**
+   * @brief Get the table of a label file, it is read on the first call
+   *
+   * @param file
+   * @return ptr
+   */
+  static ptr load(const std::string& file) {
+    static std::mutex mtx;
+    static std::map<std::string, ptr> cache;
+    std::lock_guard<std::mutex> lk(mtx);
+    auto& table = cache[file];
+    if (!table) {
+      std::shared_ptr<label_table> t = std::make_shared<label_table>();
+      std::ifstream input(file);
+      std::string line;
+      while (std::getline(input, line, '\n')) {
+        t->names.push_back(line);
+        t->quoted.emplace_back();
+        st::json::quote(line, t->quoted.back());
+      }
+      table = t;
+    }
+    return table;
+  }
+  /**
+   * @brief Name of a label, empty if the id is out of the table
+   *
+   * @param label_id
+   * @return const std::string&
+   */
+  const std::string& name(int label_id) const {
+    if (label_id <= 0 || label_id > static_cast<int>(names.size())) {
+      return none();
+    }
+    return names[label_id - 1];
+  }
+  /**
+   * @brief Name of a label as a quoted and escaped JSON string
+   *
+   * @param label_id
+   * @return const std::string&
+   */
+  const std::string& json_name(int label_id) const {
+    if (label_id <= 0 || label_id > static_cast<int>(quoted.size())) {
+      return json_none();
+    }
+    return quoted[label_id - 1];
+  }
+  size_t size() const { return names.size(); }
+  static const std::string& none() {
+    static const std::string empty;
+    return empty;
+  }
+  static const std::string& json_none() {
+    static const std::string empty = "\"\"";
+    return empty;
+  }
+
+ private:
+  std::vector<std::string> names;
+  std::vector<std::string> quoted;  //!< names escaped for the JSON responses
+};
+
+/**
+ * @brief Prediction of one image
+ * @details The boxes keep their capacity when the result is cleared, so a
+ * result that is reused from one request to the next stops allocating once
+ * it is large enough.
+ */
+struct detection_result {
+  std::vector<bbox> boxes;
+  label_table::ptr labels;  //!< labels of the engine that wrote the boxes
+  bool expired = false;  //!< dropped without inference, deadline passed
+  bool rejected = false;  //!< never queued, the task queues were full
+  bool failed = false;  //!< the engine threw, no prediction
+  size_t size() const { return boxes.size(); }
+  void clear() {
+    boxes.clear();
+    expired = false;
+    rejected = false;
+    failed = false;
+  }
+  /**
+   * @brief Name of the label of a box
+   *
+   * @param b
+   * @return const std::string&
+   */
+  const std::string& label(const bbox& b) const {
+    return labels ? labels->name(b.label_id) : label_table::none();
+  }
+  const std::string& json_label(const bbox& b) const {
+    return labels ? labels->json_name(b.label_id) : label_table::json_none();
+  }
+};
+
+/**
+ * @brief Write a prediction as the JSON body of a response
+ * @details {"predictions": [{"label_id", "label", "confidences",
+ * "detection_box"}]}, the box is left out for classification. With legacy,
+ * the numbers are written as strings and no prediction as an empty string,
+ * like the boost::property_tree writer of the older versions did.
+ * @param result
+ * @param legacy
+ * @param w writer of the document, the prediction is written as one value
+ */
+inline void write_json(const detection_result& result, bool legacy,
+                       st::json::writer& w) {
+  w.begin_object().key("predictions");
+  if (legacy && result.boxes.empty()) {
+    w.string("");
+  } else {
+    w.begin_array();
+    for (const bbox& pred : result.boxes) {
+      w.begin_object();
+      w.key("label_id").number(pred.label_id);
+      w.key("label").raw_string(result.json_label(pred));
+      w.key("confidences").number(pred.prop);
+      if (pred.c[3]) {  // ymax should never be zero
+        w.key("detection_box").begin_array();
+        for (int i = 0; i < 4; ++i) w.number(static_cast<int>(pred.c[i]));
+        w.end_array();
+      }
+      w.end_object();
+    }
+    w.end_array();
+  }
+  w.end_object();
+}
+inline void write_json(const detection_result& result, bool legacy,
+                       std::string& out) {
+  st::json::writer w(out, legacy);
+  write_json(result, legacy, w);
+  out.push_back('\n');
+}
+
+/**
+ * @brief Binary encoding of the predictions, served to the clients that send
+ * Accept: application/x-st-detections
+ * @details All the fields are little-endian:
+ * - header: magic "STD1", u8 version, u8 flags, u16 zero, u32 record count
+ * - with the packed::labels flag, the label table: u32 count, then for each
+ * label a u16 length and the UTF-8 name, the first label has id 1
+ * - the records: i32 label_id, f32 confidence, then the box xmin, ymin, xmax,
+ * ymax as i16 (16 bytes a record), or as f32 with the packed::float_box flag
+ * (24 bytes a record) when a coordinate doesn't fit in i16. The box is all
+ * zero for classification.
+ */
+namespace packed {
+constexpr char content_type[] = "application/x-st-detections";
+constexpr unsigned char version = 1;
+constexpr unsigned char float_box = 1;  //!< flag, f32 coordinates
+constexpr unsigned char labels = 2;     //!< flag, the label table follows
+constexpr size_t header_size = 12;
+
+inline void put_u16(std::uint32_t v, char* p) {
+  p[0] = static_cast<char>(v & 0xFF);
+  p[1] = static_cast<char>((v >> 8) & 0xFF);
+}
+inline void put_u32(std::uint32_t v, char* p) {
+  put_u16(v & 0xFFFF, p);
+  put_u16(v >> 16, p + 2);
+}
+inline void put_f32(float v, char* p) {
+  std::uint32_t u;
+  std::memcpy(&u, &v, sizeof(u));
+  put_u32(u, p);
+}
+}  // namespace packed
+
+/**
+ * @brief Write a prediction in the binary encoding
+ *
+ * @param result
+ * @param with_labels also write the label table of the result
+ * @param out the message is appended to it
+ */
+inline void write_packed(const detection_result& result, bool with_labels,
+                         std::string& out) {
+  // the i16 coordinates are truncated like the JSON responses
+  bool fit_i16 = true;
+  for (const bbox& b : result.boxes) {
+    for (int i = 0; i < 4; ++i) {
+      fit_i16 = fit_i16 && b.c[i] > -32769.f && b.c[i] < 32768.f;
+    }
+  }
+  with_labels = with_labels && result.labels;
+  unsigned char flags = fit_i16 ? 0 : packed::float_box;
+  if (with_labels) flags |= packed::labels;
+  const size_t record_size = fit_i16 ? 16 : 24;
+  size_t pos = out.size();
+  out.resize(pos + packed::header_size);
+  char* p = &out[pos];
+  std::memcpy(p, "STD1", 4);
+  p[4] = static_cast<char>(packed::version);
+  p[5] = static_cast<char>(flags);
+  packed::put_u16(0, p + 6);
+  packed::put_u32(static_cast<std::uint32_t>(result.size()), p + 8);
+  if (with_labels) {
+    const label_table& table = *result.labels;
+    const int n = static_cast<int>(table.size());
+    char count[4];
+    packed::put_u32(n, count);
+    out.append(count, 4);
+    for (int id = 1; id <= n; ++id) {
+      const std::string& name = table.name(id);
+      const size_t len = std::min<size_t>(name.size(), 0xFFFF);
+      char len_bytes[2];
+      packed::put_u16(static_cast<std::uint32_t>(len), len_bytes);
+      out.append(len_bytes, 2);
+      out.append(name, 0, len);
+    }
+  }
+  pos = out.size();
+  out.resize(pos + record_size * result.size());
+  p = &out[0] + pos;
+  for (const bbox& b : result.boxes) {
+    packed::put_u32(static_cast<std::uint32_t>(b.label_id), p);
+    packed::put_f32(b.prop, p + 4);
+    p += 8;
+    for (int i = 0; i < 4; ++i) {
+      if (fit_i16) {
+        packed::put_u16(static_cast<std::uint16_t>(static_cast<int>(b.c[i])),
+                        p);
+        p += 2;
+      } else {
+        packed::put_f32(b.c[i], p);
+        p += 4;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Pixel format of the input data
+ *
+ */
+enum class pixel_format {
+  ENCODED,  //!< encoded image (JPEG, PNG, ...), decoded by OpenCV
+  BGR,      //!< raw 8-bit interleaved BGR frame
+  RGB,      //!< raw 8-bit interleaved RGB frame
+  NV12      //!< raw NV12 frame, Y plane then interleaved UV plane
+};
+
+/**
+ * @brief Description of the input data of a request
+ * @details Raw frames skip the decoding, they are only wrapped (BGR) or
+ * converted to BGR (RGB, NV12) before the preprocessing.
+ */
+struct image_format {
+  pixel_format format = pixel_format::ENCODED;
+  int width = 0;   //!< raw frames only, in pixels
+  int height = 0;  //!< raw frames only, in pixels
+  int stride = 0;  //!< raw frames only, bytes per row, 0 for packed rows
+  //! largest width or height of a raw frame, in pixels
+  static constexpr int max_dimension = 16384;
+  bool raw() const { return format != pixel_format::ENCODED; }
+  /**
+   * @brief Bytes per row of the frame
+   *
+   * @return size_t
+   */
+  size_t row_bytes() const {
+    if (stride > 0) return static_cast<size_t>(stride);
+    const size_t pixels = static_cast<size_t>(width);
+    return format == pixel_format::NV12 ? pixels : 3 * pixels;
+  }
+  /**
+   * @brief Check the dimensions of a raw frame against the size of its data
+   * @details The dimensions come from the client, they are bounded by
+   * max_dimension before any arithmetic so that nothing overflows.
+   * @param size size of the data
+   * @return true for encoded images and raw frames that fit in size bytes
+   */
+  bool valid(size_t size) const {
+    if (!raw()) return true;
+    if (width <= 0 || height <= 0 || width > max_dimension ||
+        height > max_dimension) {
+      return false;
+    }
+    const size_t pixel_bytes = format == pixel_format::NV12 ? 1 : 3;
+    const size_t line = pixel_bytes * static_cast<size_t>(width);
+    if (row_bytes() < line) return false;
+    // the chroma of NV12 is subsampled by 2 in both directions
+    if (format == pixel_format::NV12 && (width % 2 || height % 2)) return false;
+    const size_t rows = format == pixel_format::NV12
+                            ? static_cast<size_t>(height) * 3 / 2
+                            : static_cast<size_t>(height);
+    // at most 2^31 * 24576 + 49152, far from the limit of a 64-bit size_t
+    const uint64_t needed =
+        static_cast<uint64_t>(row_bytes()) * (rows - 1) + line;
+    return size >= needed;
+  }
+};
+
+/**
+ * @brief Options of one inference request
+ * @details The fields that are left unset fall back to the configuration of
+ * the inference engine
+ */
+struct inference_params {
+  int top_k = 0;                //!< number of classes returned, 0 to unset
+  float min_confidence = -1.f;  //!< lowest confidence returned, < 0 to unset
+  image_format input;           //!< format of the data, encoded by default
+  int top_k_or(int fallback) const { return top_k > 0 ? top_k : fallback; }
+  float min_confidence_or(float fallback) const {
+    return min_confidence >= 0 ? min_confidence : fallback;
+  }
+};
+
+/**
+ * @brief Message template that can hold object detection result
+ *
+ * @tparam simple_bell
+ */
+template <class simple_bell>
+class obj_detection_msg
+    : public st::sync::message<const char*, int, detection_result*,
+                               simple_bell> {
+ public:
+  using st::sync::message<const char*, int, detection_result*,
+                          simple_bell>::message;
+  inference_params params;  //!< options of the request
+  // the requester gives up after it, the task is dropped if it is still in
+  // the queue by then
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+};
+
+/**
+ * @brief Object detection message queue that can be used to exchange object
+ * detection message
+ * @details One bounded lock-free queue per inference replica. All the
+ * replicas serve the same model, so any replica may steal from any other,
+ * see dispatcher. The protocol layers push with
+ * try_push and turn the request away when the queues are full, the inference
+ * workers pop with their replica index.
+ * @tparam simple_bell
+ */
+template <class simple_bell>
+using object_detection_mq =
+    st::sync::dispatcher<obj_detection_msg<simple_bell>>;
+
+}  // namespace ie
+}  // namespace st
@@ -0,0 +1,209 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement a streaming JSON writer for the responses
+ ***************************************************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace st {
+namespace json {
+
+/**
+ * @brief Append a string to a buffer as a quoted JSON string
+ * @details Quotes, backslashes and control characters are escaped, other
+ * bytes (including UTF-8 sequences) are copied as they are
+ * @param s
+ * @param out
+ */
+inline void quote(const std::string& s, std::string& out) {
+  static const char hex[] = "0123456789abcdef";
+  out.push_back('"');
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':
+        out.append("\\\"");
+        break;
+      case '\\':
+        out.append("\\\\");
+        break;
+      case '\n':
+        out.append("\\n");
+        break;
+      case '\r':
+        out.append("\\r");
+        break;
+      case '\t':
+        out.append("\\t");
+        break;
+      default:
+        if (c < 0x20) {
+          out.append("\\u00");
+          out.push_back(hex[c >> 4]);
+          out.push_back(hex[c & 0xF]);
+        } else {
+          out.push_back(static_cast<char>(c));
+        }
+    }
+  }
+  out.push_back('"');
+}
+
+/**
+ * @brief Append an integer to a buffer
+ *
+ * @param v
+ * @param out
+ */
+inline void append_int(long long v, std::string& out) {
+  char buf[24];
+  char* p = buf + sizeof(buf);
+  unsigned long long u = v < 0 ? 0ULL - static_cast<unsigned long long>(v)
+                                : static_cast<unsigned long long>(v);
+  do {
+    *--p = static_cast<char>('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (v < 0) *--p = '-';
+  out.append(p, buf + sizeof(buf) - p);
+}
+
+/**
+ * @brief Append a float to a buffer as a JSON number
+ * @details Values in [1e-4, 1e9) are written with at most 6 decimals and no
+ * trailing zero, without going through the locale of the stream or printf.
+ * Other values fall back to printf, and NaN and infinities, which JSON cannot
+ * represent, are written as null.
+ * @param v
+ * @param out
+ */
+inline void append_float(float v, std::string& out) {
+  if (!std::isfinite(v)) {
+    out.append("null");
+    return;
+  }
+  const double a = std::fabs(static_cast<double>(v));
+  if (a != 0 && (a < 1e-4 || a >= 1e9)) {
+    char buf[32];
+    const int n = std::snprintf(buf, sizeof(buf), "%.7g", v);
+    out.append(buf, n);
+    return;
+  }
+  const long long scale = 1000000;
+  const long long fixed = std::llround(a * scale);
+  if (v < 0 && fixed != 0) out.push_back('-');
+  append_int(fixed / scale, out);
+  long long frac = fixed % scale;
+  if (frac == 0) return;
+  char digits[6];
+  int n = 6;
+  for (int i = 5; i >= 0; --i) {
+    digits[i] = static_cast<char>('0' + frac % 10);
+    frac /= 10;
+  }
+  while (digits[n - 1] == '0') --n;
+  out.push_back('.');
+  out.append(digits, n);
+}
+
+/**
+ * @brief Streaming JSON writer
+ * @details The document is appended to a buffer owned by the caller, which
+ * keeps its capacity from one response to the next. The writer only tracks
+ * where the commas go, the caller is responsible for a well-formed nesting
+ * (at most 64 levels). With quote_numbers, numbers are written as strings
+ * like boost::property_tree does.
+ */
+class writer {
+ public:
+  writer(std::string& _out, bool _quote_numbers = false)
+      : out(_out), quote_numbers(_quote_numbers) {}
+  writer& begin_object() { return open('{'); }
+  writer& end_object() { return close('}'); }
+  writer& begin_array() { return open('['); }
+  writer& end_array() { return close(']'); }
+  /**
+   * @brief Write the key of the next member
+   *
+   * @param k a literal that doesn't need to be escaped
+   * @return writer&
+   */
+  writer& key(const char* k) {
+    separator();
+    out.push_back('"');
+    out.append(k);
+    out.append("\":");
+    after_key = true;
+    return *this;
+  }
+  writer& string(const std::string& s) {
+    separator();
+    quote(s, out);
+    return *this;
+  }
+  /**
+   * @brief Write a string that is already quoted and escaped
+   *
+   * @param quoted
+   * @return writer&
+   */
+  writer& raw_string(const std::string& quoted) {
+    separator();
+    out.append(quoted);
+    return *this;
+  }
+  writer& number(int v) {
+    separator();
+    if (quote_numbers) out.push_back('"');
+    append_int(v, out);
+    if (quote_numbers) out.push_back('"');
+    return *this;
+  }
+  writer& number(float v) {
+    separator();
+    if (quote_numbers) out.push_back('"');
+    append_float(v, out);
+    if (quote_numbers) out.push_back('"');
+    return *this;
+  }
+
+ private:
+  std::string& out;
+  bool quote_numbers;
+  int depth = 0;
+  std::uint64_t has_items = 0;  //!< bit d: the container at depth d has items
+  bool after_key = false;
+
+  // a comma before every item of a container but the first one
+  void separator() {
+    if (after_key) {
+      after_key = false;
+      return;
+    }
+    if (depth == 0) return;
+    const std::uint64_t bit = std::uint64_t(1) << (depth - 1);
+    if (has_items & bit) out.push_back(',');
+    has_items |= bit;
+  }
+  writer& open(char c) {
+    separator();
+    out.push_back(c);
+    ++depth;
+    has_items &= ~(std::uint64_t(1) << (depth - 1));
+    return *this;
+  }
+  writer& close(char c) {
+    out.push_back(c);
+    --depth;
+    return *this;
+  }
+};
+
+}  // namespace json
+}  // namespace st
@@ -6,12 +6,17 @@
  ***************************************************************************************/
 
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
+#include "st_futex.h"
 
 namespace st {
 namespace sync {
@@ -125,6 +130,113 @@ using single_bell = simple_bell<int, int, 0>;
 template <const char* reset_state>
 using shared_bell = simple_bell<std::string, const char*, reset_state>;
 
+/**
+ * @brief One-shot completion latch, allocation free
+ * @details The bell is a member of its owner (session, call, ...) and is
+ * reused by all the requests of the owner, the messages carry a plain
+ * pointer to it. The owner arms the bell with the number of messages that
+ * carry it, then either blocks in wait or registers a handler with on_ring,
+ * and the consumer rings once per message. The last ring wakes the waiter
+ * up with a futex, or runs the handler in the consumer thread.
+ *
+ * The handler is a function pointer and a context, so registering it
+ * allocates nothing. It should be short, e.g. post the real work to the
+ * event loop of the owner. The owner must not re-arm the bell before the
+ * last ring.
+ */
+class latch_bell {
+ public:
+  using handler_type = void (*)(void* context);
+  latch_bell() = default;
+  latch_bell(const latch_bell& other) = delete;
+  latch_bell& operator=(const latch_bell& rhs) = delete;
+  /**
+   * @brief Arm the bell for a blocking wait
+   *
+   * @param rings number of rings before wait returns
+   */
+  void expect(int rings = 1) {
+    handler = nullptr;
+    context = nullptr;
+    state.store(static_cast<std::uint32_t>(rings), std::memory_order_release);
+  }
+  /**
+   * @brief Arm the bell with a handler
+   *
+   * @param _handler called with _context by the last ring
+   * @param _context
+   * @param rings number of rings before the handler is called
+   */
+  void on_ring(handler_type _handler, void* _context, int rings = 1) {
+    handler = _handler;
+    context = _context;
+    state.store(static_cast<std::uint32_t>(rings), std::memory_order_release);
+  }
+  /**
+   * @brief Arm the bell with a member function of the owner
+   *
+   * @tparam Owner
+   * @tparam method called on owner by the last ring
+   * @param owner
+   * @param rings number of rings before the method is called
+   */
+  template <class Owner, void (Owner::*method)()>
+  void on_ring(Owner* owner, int rings = 1) {
+    on_ring(&invoke<Owner, method>, owner, rings);
+  }
+  /**
+   * @brief Ring the bell
+   * @details With several rings expected, the last one runs the handler or
+   * wakes the waiter up, after all the consumers are done.
+   * @param set_state unused, keep the same interface with simple_bell
+   */
+  void ring(int&& set_state = 1) {
+    // read before the ring, a woken waiter may destroy the bell right away
+    const handler_type h = handler;
+    void* const c = context;
+    // acq_rel: the last ring sees the results written by the other consumers
+    const std::uint32_t s = state.fetch_sub(1, std::memory_order_acq_rel);
+    if ((s & count_mask) != 1) return;
+    if (h != nullptr) {
+      h(c);
+    } else if (s & sleeping) {
+      futex_wake(state);
+    }
+  }
+  /**
+   * @brief Wait until the bell armed with expect has rung
+   *
+   */
+  void wait() {
+    std::uint32_t s = state.load(std::memory_order_acquire);
+    while (s & count_mask) {
+      if (!(s & sleeping)) {
+        // tell the last ring to make the syscall
+        if (!state.compare_exchange_weak(s, s | sleeping,
+                                         std::memory_order_acquire)) {
+          continue;
+        }
+        s |= sleeping;
+      }
+      futex_wait(state, s);
+      s = state.load(std::memory_order_acquire);
+    }
+  }
+  using ptr = latch_bell*;
+
+ private:
+  static constexpr std::uint32_t sleeping = 1u << 31;
+  static constexpr std::uint32_t count_mask = sleeping - 1;
+  std::atomic<std::uint32_t> state{0};  //!< rings left, and sleeping bit
+  handler_type handler = nullptr;
+  void* context = nullptr;
+
+  template <class Owner, void (Owner::*method)()>
+  static void invoke(void* owner) {
+    (static_cast<Owner*>(owner)->*method)();
+  }
+};
+
 /**
  * @brief A message template that producer and consumer will use to communicate
  * @tparam DataPtr
@@ -156,7 +268,7 @@ class message {
    * @param _bell
    */
   message(DataPtr& _data, Ssize& _size, ResponsePtr _predictions,
-          BellPtr& _bell)
+          const BellPtr& _bell)
       : data(_data), size(_size), predictions(_predictions), bell(_bell) {}
   /**
    * @brief
@@ -180,26 +292,30 @@ class message {
    */
   message(const message& other) { *this = other; }
   /**
-   * @brief
+   * @brief Move assignment, the bell is moved without touching its reference
+   * count and rhs is left empty
    *
    * @param rhs
    * @return message&
    */
-  message& operator=(const message&& rhs) {
-    if (this != rhs) {
-      this = rhs;
+  message& operator=(message&& rhs) {
+    if (this != &rhs) {
+      data = rhs.data;
+      size = rhs.size;
+      predictions = rhs.predictions;
+      bell = std::move(rhs.bell);
       rhs.data = nullptr;
       rhs.size = -1;
       rhs.predictions = nullptr;
-      rhs.bell = nullptr;
     }
+    return *this;
   }
   /**
    * @brief Construct a new message object
    *
    * @param other
    */
-  message(const message&& other) { *this = other; }
+  message(message&& other) : message() { *this = std::move(other); }
 };
 
 /**
@@ -246,6 +362,29 @@ class blocking_queue {
     }
     cv.notify_one();
   }
+  /**
+   * @brief Push a range of items to queue under one lock
+   * @details The items are queued back to back, so that a worker with dynamic
+   * batching takes them in as few batches as possible
+   * @tparam Iterator
+   * @param first
+   * @param last
+   */
+  template <class Iterator>
+  void push(Iterator first, Iterator last) {
+    size_t n = 0;
+    {
+      Lock lk{mtx};
+      for (; first != last; ++first, ++n) {
+        queue.push_back(*first);
+      }
+    }
+    if (n > 1) {
+      cv.notify_all();
+    } else if (n == 1) {
+      cv.notify_one();
+    }
+  }
   /**
    * @brief Pop an item from queue
    *
@@ -258,6 +397,32 @@ class blocking_queue {
     queue.pop_front();
     return ret;
   }
+  /**
+   * @brief Pop a batch of items from queue
+   * @details Block until there is at least one item, then keep taking items
+   * until the batch is full or max_delay has passed since the first item was
+   * taken, whichever comes first
+   * @param batch where the items are appended to
+   * @param max_batch maximum number of items in the batch
+   * @param max_delay maximum time to wait for the batch to be full
+   */
+  template <class Rep, class Period>
+  void pop_batch(std::vector<Message>& batch, size_t max_batch,
+                 const std::chrono::duration<Rep, Period>& max_delay) {
+    Lock lk(mtx);
+    cv.wait(lk, [&]() { return queue.size() > 0; });
+    auto deadline = std::chrono::steady_clock::now() + max_delay;
+    for (;;) {
+      while (queue.size() > 0 && batch.size() < max_batch) {
+        batch.push_back(std::move(queue.front()));
+        queue.pop_front();
+      }
+      if (batch.size() >= max_batch ||
+          !cv.wait_until(lk, deadline, [&]() { return queue.size() > 0; })) {
+        break;
+      }
+    }
+  }
   /**
    * @brief Get current number of item in queue
    *
@@ -0,0 +1,467 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement a bounded lock-free multi-producer
+ * multi-consumer queue, a drop-in for blocking_queue
+ ***************************************************************************************/
+
+#pragma once
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "st_futex.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace st {
+namespace sync {
+
+constexpr size_t cache_line = 64;
+
+/**
+ * @brief Hint the CPU that we are spinning
+ *
+ */
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#endif
+}
+
+/**
+ * @brief Number of tries of a blocking call before it sleeps
+ * @details Spinning on one core only delays the thread we are waiting for
+ * @return int
+ */
+inline int spin_count() {
+  static const int count = std::thread::hardware_concurrency() > 1 ? 64 : 0;
+  return count;
+}
+
+/**
+ * @brief Event count on a futex
+ * @details Lets threads sleep until a condition that is checked without any
+ * lock becomes true. A waiter announces itself with prepare_wait, checks the
+ * condition, then sleeps with wait only if it is still false. A notifier
+ * makes the condition true, then calls notify_one, which hands a signal to a
+ * waiter that has none yet. A notification that comes between the check and
+ * the sleep is never lost, and notify_one costs one load when every waiter
+ * already has a signal, so a burst of pushes makes one syscall, not one per
+ * push. A signal goes to any waiter, so when only some waiters can use the
+ * condition, e.g. an item for one consumer, notify_all wakes every waiter
+ * that announced itself before it, whatever the signals.
+ */
+class event_count {
+ public:
+  /**
+   * @brief Announce a wait
+   *
+   * @return std::uint32_t key to pass to wait
+   */
+  std::uint32_t prepare_wait() {
+    state.fetch_add(1, std::memory_order_seq_cst);
+    return generation.load(std::memory_order_seq_cst);
+  }
+  /**
+   * @brief The condition became true after prepare_wait, don't wait
+   *
+   */
+  void cancel_wait() { leave(); }
+  /**
+   * @brief Sleep until a notification that comes after prepare_wait
+   *
+   * @param key returned by prepare_wait
+   */
+  void wait(std::uint32_t key) {
+    for (;;) {
+      const std::uint32_t current = epoch.load(std::memory_order_seq_cst);
+      if (take_signal()) return;
+      if (broadcast(key)) return;
+      futex_wait(epoch, current);
+    }
+  }
+  /**
+   * @brief Sleep until a notification that comes after prepare_wait, or
+   * until the deadline
+   *
+   * @param key returned by prepare_wait
+   * @param deadline
+   * @return false on timeout
+   */
+  bool wait_until(std::uint32_t key,
+                  std::chrono::steady_clock::time_point deadline) {
+    for (;;) {
+      const std::uint32_t current = epoch.load(std::memory_order_seq_cst);
+      if (take_signal()) return true;
+      if (broadcast(key)) return true;
+      const auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::steady_clock::duration::zero()) {
+        leave();
+        return false;
+      }
+      const auto ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      timespec timeout;
+      timeout.tv_sec = ns / 1000000000;
+      timeout.tv_nsec = ns % 1000000000;
+      futex_wait(epoch, current, &timeout);
+    }
+  }
+  /**
+   * @brief Wake up one waiter
+   *
+   */
+  void notify_one() {
+    // order the publication of the condition before the load of the state,
+    // pairs with the fetch_add of prepare_wait
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::uint32_t s = state.load(std::memory_order_relaxed);
+    for (;;) {
+      const std::uint32_t waiters = s & count_mask;
+      const std::uint32_t signals = s >> 16;
+      if (signals == waiters) return;
+      if (state.compare_exchange_weak(s, s + signal,
+                                      std::memory_order_seq_cst)) {
+        break;
+      }
+    }
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    futex_wake(epoch, 1);
+  }
+  /**
+   * @brief Wake up all the waiters
+   *
+   */
+  void notify_all() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if ((state.load(std::memory_order_relaxed) & count_mask) == 0) return;
+    // the generation before the epoch: a waiter that reads the old epoch
+    // either sees the new generation or is woken up by the new epoch
+    generation.fetch_add(1, std::memory_order_seq_cst);
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    futex_wake(epoch);
+  }
+
+ private:
+  // low half: threads between prepare_wait and the end of their wait,
+  // high half: signals handed to them and not taken yet, never more than the
+  // number of waiters
+  std::atomic<std::uint32_t> state{0};
+  std::atomic<std::uint32_t> epoch{0};  //!< the futex word
+  std::atomic<std::uint32_t> generation{0};  //!< count of notify_all
+  static constexpr std::uint32_t waiter = 1;
+  static constexpr std::uint32_t signal = 1 << 16;
+  static constexpr std::uint32_t count_mask = signal - 1;
+
+  // end a wait that was broadcast
+  bool broadcast(std::uint32_t key) {
+    if (generation.load(std::memory_order_seq_cst) == key) return false;
+    leave();
+    return true;
+  }
+  // end a wait that was signaled
+  bool take_signal() {
+    std::uint32_t s = state.load(std::memory_order_seq_cst);
+    while (s >> 16) {
+      if (state.compare_exchange_weak(s, s - signal - waiter,
+                                      std::memory_order_seq_cst)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // end a wait that was not signaled, a signal that can't go to another
+  // waiter goes with it
+  void leave() {
+    std::uint32_t s = state.load(std::memory_order_seq_cst);
+    for (;;) {
+      const std::uint32_t waiters = (s & count_mask) - 1;
+      const std::uint32_t signals = std::min(s >> 16, waiters);
+      if (state.compare_exchange_weak(s, waiters | signals << 16,
+                                      std::memory_order_seq_cst)) {
+        return;
+      }
+    }
+  }
+};
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue
+ * @details The ring of Dmitry Vyukov: every cell carries a sequence number
+ * that tells whether it is free for the producer of a given position or full
+ * for the consumer of that position, so producers and consumers only contend
+ * on one CAS of their own index. The indices are on separate cache lines, and
+ * so is every cell. Blocking calls spin for a while then sleep on an
+ * event_count. The
+ * interface is the one of blocking_queue, plus try_push and try_pop which
+ * never block. push blocks while the queue is full.
+ * @tparam Message Message type, default constructible and move assignable
+ */
+template <class Message>
+class mpmc_queue {
+ public:
+  /**
+   * @brief Construct a new mpmc queue object
+   *
+   * @param capacity maximum number of items, rounded up to a power of two
+   */
+  explicit mpmc_queue(size_t capacity = 1024) {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    mask = n - 1;
+    // new ignores the alignment of cell before C++17, align the ring by hand
+    size_t space = (n + 1) * sizeof(cell);
+    storage.reset(new char[space]);
+    void* p = storage.get();
+    cells = static_cast<cell*>(
+        std::align(alignof(cell), n * sizeof(cell), p, space));
+    for (size_t i = 0; i < n; ++i) {
+      new (&cells[i]) cell();
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  ~mpmc_queue() {
+    for (size_t i = 0; i <= mask; ++i) cells[i].~cell();
+  }
+  mpmc_queue(const mpmc_queue&) = delete;
+  mpmc_queue& operator=(const mpmc_queue&) = delete;
+  /**
+   * @brief Push an item if the queue is not full
+   *
+   * @param item
+   * @return false if the queue is full
+   */
+  bool try_push(const Message& item) {
+    Message copy(item);
+    return try_push(std::move(copy));
+  }
+  bool try_push(Message&& item) {
+    if (!try_push_quiet(std::move(item))) return false;
+    not_empty.notify_one();
+    return true;
+  }
+  /**
+   * @brief Push an item if the queue is not full, without waking a consumer
+   * @details For owners whose consumers never block in pop or pop_batch,
+   * e.g. deadline_queue, which saves the fence of the notification
+   * @param item moved from only on success
+   * @return false if the queue is full
+   */
+  bool try_push_quiet(Message&& item) {
+    size_t pos;
+    cell* c = claim_push(pos);
+    if (c == nullptr) return false;
+    c->value = std::move(item);
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * @brief Pop an item if the queue is not empty
+   *
+   * @param item
+   * @return false if the queue is empty
+   */
+  bool try_pop(Message& item) {
+    if (!try_pop_quiet(item)) return false;
+    not_full.notify_one();
+    return true;
+  }
+  /**
+   * @brief Pop an item if the queue is not empty, without waking a producer
+   * @details The caller calls wake_producers once it is done popping, so
+   * that a producer blocked in push sees the free cells
+   * @param item
+   * @return false if the queue is empty
+   */
+  bool try_pop_quiet(Message& item) {
+    size_t pos;
+    cell* c = claim_pop(pos);
+    if (c == nullptr) return false;
+    item = std::move(c->value);
+    c->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * @brief Wake the producers blocked in push, after try_pop_quiet
+   *
+   */
+  void wake_producers() { not_full.notify_all(); }
+  /**
+   * @brief Push an item to queue, wait while the queue is full
+   *
+   * @param item
+   */
+  void push(const Message& item) {
+    Message copy(item);
+    push(std::move(copy));
+  }
+  void push(Message&& item) {
+    for (int i = 0; i < spin_count(); ++i) {
+      if (try_push(std::move(item))) return;
+      cpu_relax();
+    }
+    for (;;) {
+      const std::uint32_t key = not_full.prepare_wait();
+      if (try_push(std::move(item))) {
+        not_full.cancel_wait();
+        return;
+      }
+      not_full.wait(key);
+    }
+  }
+  /**
+   * @brief Push a range of items to queue
+   *
+   * @tparam Iterator
+   * @param first
+   * @param last
+   */
+  template <class Iterator>
+  void push(Iterator first, Iterator last) {
+    for (; first != last; ++first) push(*first);
+  }
+  /**
+   * @brief Pop an item from queue, wait while the queue is empty
+   *
+   * @return Message
+   */
+  Message pop() {
+    Message ret;
+    for (int i = 0; i < spin_count(); ++i) {
+      if (try_pop(ret)) return ret;
+      cpu_relax();
+    }
+    for (;;) {
+      const std::uint32_t key = not_empty.prepare_wait();
+      if (try_pop(ret)) {
+        not_empty.cancel_wait();
+        return ret;
+      }
+      not_empty.wait(key);
+    }
+  }
+  /**
+   * @brief Pop a batch of items from queue
+   * @details Block until there is at least one item, then keep taking items
+   * until the batch is full or max_delay has passed since the first item was
+   * taken, whichever comes first
+   * @param batch where the items are appended to
+   * @param max_batch maximum number of items in the batch
+   * @param max_delay maximum time to wait for the batch to be full
+   */
+  template <class Rep, class Period>
+  void pop_batch(std::vector<Message>& batch, size_t max_batch,
+                 const std::chrono::duration<Rep, Period>& max_delay) {
+    const size_t target = batch.size() + std::max<size_t>(max_batch, 1);
+    batch.push_back(pop());
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::duration_cast<
+                              std::chrono::steady_clock::duration>(max_delay);
+    Message item;
+    while (batch.size() < target) {
+      if (try_pop(item)) {
+        batch.push_back(std::move(item));
+        continue;
+      }
+      const std::uint32_t key = not_empty.prepare_wait();
+      if (try_pop(item)) {
+        not_empty.cancel_wait();
+        batch.push_back(std::move(item));
+        continue;
+      }
+      if (!not_empty.wait_until(key, deadline)) break;
+    }
+  }
+  /**
+   * @brief Get current number of item in queue, a snapshot that may be
+   * outdated as soon as it returns
+   *
+   * @return int
+   */
+  int size() const {
+    const size_t tail = dequeue_pos.load(std::memory_order_relaxed);
+    const size_t head = enqueue_pos.load(std::memory_order_relaxed);
+    return head > tail ? static_cast<int>(std::min(head - tail, mask + 1))
+                       : 0;
+  }
+  /**
+   * @brief Maximum number of items
+   *
+   * @return size_t
+   */
+  size_t capacity() const { return mask + 1; }
+  using ptr = std::shared_ptr<mpmc_queue>;
+
+ private:
+  // one cell per cache line at least, so that the producer and the consumer
+  // of neighbouring positions don't share a line
+  struct alignas(cache_line) cell {
+    std::atomic<size_t> sequence;
+    Message value;
+  };
+
+  char pad0[cache_line];
+  std::atomic<size_t> enqueue_pos{0};
+  char pad1[cache_line - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos{0};
+  char pad2[cache_line - sizeof(std::atomic<size_t>)];
+  size_t mask = 0;
+  std::unique_ptr<char[]> storage;  //!< the cells, with room to align them
+  cell* cells = nullptr;
+  event_count not_empty;  //!< consumers wait for an item
+  event_count not_full;   //!< producers wait for a free cell
+
+  // reserve the next position for a producer, nullptr if the queue is full
+  cell* claim_push(size_t& pos) {
+    pos = enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell* c = &cells[pos & mask];
+      const size_t seq = c->sequence.load(std::memory_order_acquire);
+      const std::intptr_t dif =
+          static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+      if (dif == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          return c;
+        }
+      } else if (dif < 0) {
+        return nullptr;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  // reserve the next position for a consumer, nullptr if the queue is empty
+  cell* claim_pop(size_t& pos) {
+    pos = dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell* c = &cells[pos & mask];
+      const size_t seq = c->sequence.load(std::memory_order_acquire);
+      const std::intptr_t dif = static_cast<std::intptr_t>(seq) -
+                                static_cast<std::intptr_t>(pos + 1);
+      if (dif == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          return c;
+        }
+      } else if (dif < 0) {
+        return nullptr;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+};
+
+}  // namespace sync
+}  // namespace st
@@ -56,6 +56,8 @@ public:
     // inference engine
     server_log->info("Creating inference engines");
     std::vector<inference_engine::ptr> IEs;
+    std::vector<batching_policy> policies;  // batching policy of each IE
+    std::vector<replica_info> engines;  // device of each IE
     const auto& ie_array = config.get_child("inference engines");
     ie_factory factory;
     // iterate over all devices
@@ -67,6 +69,9 @@ public:
       auto& model = conf.get_child("model");
       if (model.size() == 0) continue;
       const int replicas = conf.get<int>("replicas");
+      // dynamic batching, disabled by default
+      const batching_policy policy{conf.get<int>("max batch", 1),
+                                   conf.get<int>("max delay us", 0)};
       bool is_fpga = device.find("fpga") != std::string::npos;
       if (is_fpga) {
         // FPGA inference worker cannot run outside of main threads
@@ -84,20 +89,44 @@ public:
       for (int i = 0; i < replicas; ++i) {
         if (is_fpga) {
           IEs.insert(IEs.begin(), factory.create_inference_engine(conf));
+          policies.insert(policies.begin(), policy);
+          engines.insert(engines.begin(), replica_info{device});
         } else {
           IEs.push_back(
               factory.create_inference_engine(conf));
+          policies.push_back(policy);
+          engines.push_back(replica_info{device});
         }
       }
     }
 
-    // task queue - Not necessary used with CPU inference
-    object_detection_mq<single_bell>::ptr TaskQueue =
-        std::make_shared<object_detection_mq<single_bell>>();
+    // task queue, one queue per IE, the IEs steal from each other
+    object_detection_mq<latch_bell>::ptr TaskQueue =
+        std::make_shared<object_detection_mq<latch_bell>>(
+            engines, config.get<size_t>("queue capacity", 1024),
+            str2policy(config.get<std::string>("scheduler",
+                                               "earliest finish")));
+    // admission control, requests beyond the limits are turned away
+    admission_limits limits;
+    limits.max_queued = config.get<int>("max queued", 0);
+    limits.max_delay =
+        std::chrono::milliseconds(config.get<int>("max queue delay ms", 0));
+    TaskQueue->set_admission(limits);
 
-    // listening worker
+    // listening worker, all connections are served by a fixed pool of I/O
+    // threads
+    const int io_threads = config.get<int>(
+        "io threads", std::max(1u, std::thread::hardware_concurrency()));
+    http_options options;
+    options.body_limit =
+        config.get<std::uint64_t>("max body size", options.body_limit);
+    options.legacy_json = config.get<bool>("legacy json", false);
+    options.max_batch_images =
+        config.get<int>("max batch images", options.max_batch_images);
+    options.overload_status =
+        int2overload_status(config.get<int>("overload status", 503));
     server_log->info("Spawning listener threads");
-    sync_listen_worker listener{TaskQueue};
+    http_listen_worker listener{TaskQueue, io_threads, options};
 
     // inference work group
     server_log->info("Spawning inference engine threads");
@@ -111,12 +140,13 @@ public:
     int num_workers = IEs.size() - 1;
     std::vector<std::thread> ie_workers(num_workers);
     for (int i = 0; i < num_workers; ++i) {
-      sync_inference_worker<inference_engine::ptr> inferencer{IEs[i + 1],
-                                                              TaskQueue};
+      sync_inference_worker<inference_engine::ptr, latch_bell> inferencer{
+          IEs[i + 1], TaskQueue, i + 1, policies[i + 1]};
       ie_workers[i] = std::thread{std::bind(inferencer)};
       ie_workers[i].detach();
     }
-    sync_inference_worker<inference_engine::ptr> inferencer{IEs[0], TaskQueue};
+    sync_inference_worker<inference_engine::ptr, latch_bell> inferencer{
+        IEs[0], TaskQueue, 0, policies[0]};
     inferencer();
   } 
   catch (const std::exception& e) {
@@ -138,6 +168,8 @@ public:
       auto port = config.get<std::string>("port");
       // inference engine
       std::vector<inference_engine::ptr> IEs;
+      std::vector<batching_policy> policies;  // batching policy of each IE
+      std::vector<replica_info> engines;  // device of each IE
       server_log->info("Creating inference engines");
       const auto& ie_array = config.get_child("inference engines");
       ie_factory factory;
@@ -150,6 +182,9 @@ public:
         auto& model = conf.get_child("model");
         if (model.size() == 0) continue;
         const int replicas = conf.get<int>("replicas");
+        // dynamic batching, disabled by default
+        const batching_policy policy{conf.get<int>("max batch", 1),
+                                     conf.get<int>("max delay us", 0)};
         bool is_fpga = device.find("fpga") != std::string::npos;
         if (is_fpga) {
           // FPGA inference worker cannot run outside of main threads
@@ -167,20 +202,43 @@ public:
         for (int i = 0; i < replicas; ++i) {
           if (is_fpga) {
             IEs.insert(IEs.begin(), factory.create_inference_engine(conf));
+            policies.insert(policies.begin(), policy);
+            engines.insert(engines.begin(), replica_info{device});
           } else {
             IEs.push_back(
                 factory.create_inference_engine(conf));
+            policies.push_back(policy);
+            engines.push_back(replica_info{device});
           }
         }
       }
 
-      // task queue - Not necessary used with CPU inference
-      object_detection_mq<single_bell>::ptr TaskQueue =
-          std::make_shared<object_detection_mq<single_bell>>();
+      // task queue, one queue per IE, the IEs steal from each other
+      object_detection_mq<latch_bell>::ptr TaskQueue =
+          std::make_shared<object_detection_mq<latch_bell>>(
+              engines, config.get<size_t>("queue capacity", 1024),
+              str2policy(config.get<std::string>("scheduler",
+                                                 "earliest finish")));
+      // admission control, requests beyond the limits are turned away
+      admission_limits limits;
+      limits.max_queued = config.get<int>("max queued", 0);
+      limits.max_delay =
+          std::chrono::milliseconds(config.get<int>("max queue delay ms", 0));
+      TaskQueue->set_admission(limits);
 
-      // listening worker
+      // listening worker, calls are served asynchronously by a fixed number
+      // of completion queues and polling threads
+      const int num_cqs = config.get<int>(
+          "completion queues", std::max(1u, std::thread::hardware_concurrency()));
+      const int num_pollers = config.get<int>("polling threads", num_cqs);
+      const int max_message_size =
+          config.get<int>("max body size", 64 * 1024 * 1024);
+      const int max_batch_images = config.get<int>("max batch images", 256);
+      const int max_stream_frames = config.get<int>("stream frames", 2);
       server_log->info("Spawning listener threads");
-      rpc_listen_worker listener{TaskQueue};
+      rpc_listen_worker listener{TaskQueue, num_cqs, num_pollers,
+                                 max_message_size, max_batch_images,
+                                 max_stream_frames};
 
       // inference work group
       server_log->info("Spawning inference engine threads");
@@ -194,12 +252,13 @@ public:
       int num_workers = IEs.size() - 1;
       std::vector<std::thread> ie_workers(num_workers);
       for (int i = 0; i < num_workers; ++i) {
-        sync_inference_worker<inference_engine::ptr> inferencer{IEs[i + 1],
-                                                                TaskQueue};
+        sync_inference_worker<inference_engine::ptr, latch_bell> inferencer{
+            IEs[i + 1], TaskQueue, i + 1, policies[i + 1]};
         ie_workers[i] = std::thread{std::bind(inferencer)};
         ie_workers[i].detach();
       }
-      sync_inference_worker<inference_engine::ptr> inferencer{IEs[0], TaskQueue};
+      sync_inference_worker<inference_engine::ptr, latch_bell> inferencer{
+          IEs[0], TaskQueue, 0, policies[0]};
       inferencer();
     } catch (const std::exception& e) {
       std::cerr << e.what() << '\n';
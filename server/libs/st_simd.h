@@ -0,0 +1,104 @@
+/***************************************************************************************
+ * Copyright (C) 2020 canhld@.kaist.ac.kr
+ * SPDX-License-Identifier: Apache-2.0
+ * @b About: This file implement the runtime detection of SIMD instruction sets
+ ***************************************************************************************/
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define ST_SIMD_X86 1
+#else
+#define ST_SIMD_X86 0
+#endif
+
+/**
+ * @brief Compile a function for an instruction set that may not be enabled for
+ * the translation unit, the caller must check simd::best_isa() before calling
+ */
+#if ST_SIMD_X86
+#define ST_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ST_TARGET(isa)
+#endif
+
+namespace st {
+namespace simd {
+
+/**
+ * @brief Instruction set levels, each level implies the previous ones
+ *
+ */
+enum class isa {
+  SCALAR = 0,  //!< no SIMD
+  SSE4 = 1,    //!< SSSE3 + SSE4.1
+  AVX2 = 2,    //!< AVX2 + F16C
+  AVX512 = 3   //!< AVX-512F
+};
+
+/**
+ * @brief Name of an instruction set level
+ *
+ * @param level
+ * @return const char*
+ */
+inline const char* isa_name(isa level) {
+  switch (level) {
+    case isa::AVX512:
+      return "avx512";
+    case isa::AVX2:
+      return "avx2";
+    case isa::SSE4:
+      return "sse4";
+    default:
+      return "scalar";
+  }
+}
+
+/**
+ * @brief Detect the best instruction set level supported by the CPU
+ *
+ * @return isa
+ */
+inline isa detect_isa() {
+#if ST_SIMD_X86
+  __builtin_cpu_init();
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+  const bool f16c = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C);
+  if (__builtin_cpu_supports("avx512f") && f16c) return isa::AVX512;
+  if (__builtin_cpu_supports("avx2") && f16c) return isa::AVX2;
+  if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) {
+    return isa::SSE4;
+  }
+#endif
+  return isa::SCALAR;
+}
+
+/**
+ * @brief Instruction set level used by the kernels
+ * @details Detected once. The environment variable ST_SIMD (scalar, sse4,
+ * avx2 or avx512) can lower it, e.g. to compare the kernels.
+ * @return isa
+ */
+inline isa best_isa() {
+  static const isa level = []() {
+    isa detected = detect_isa();
+    const char* env = std::getenv("ST_SIMD");
+    if (env == nullptr) return detected;
+    for (int i = 0; i <= static_cast<int>(detected); ++i) {
+      if (std::strcmp(env, isa_name(static_cast<isa>(i))) == 0) {
+        return static_cast<isa>(i);
+      }
+    }
+    return detected;
+  }();
+  return level;
+}
+
+}  // namespace simd
+}  // namespace st
@@ -5,14 +5,24 @@
  ***************************************************************************************/
 
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include "st_http_batch.h"
 #include "st_ie_base.h"
 #include "st_message_queue.h"
 #include "st_utils.h"
@@ -48,6 +58,17 @@ public:
   virtual void operator()() = 0;
 };
 
+/**
+ * @brief Dynamic batching policy of an inference worker
+ * @details The worker takes up to max_batch tasks from the queue, waiting at
+ * most max_delay_us microseconds for the batch to be full, then runs them
+ * together. max_batch = 1 disables batching.
+ */
+struct batching_policy {
+  int max_batch;     //!< maximum number of tasks in one batch
+  int max_delay_us;  //!< maximum time to wait for a full batch
+};
+
 /**
  * @brief Inference worker that will run the inference engine
  * @details
@@ -56,7 +77,7 @@ public:
  *
  * @exception
  */
-template <class IEPtr>
+template <class IEPtr, class Bell = latch_bell>
 class sync_inference_worker : public sync_worker {
 public:
   sync_inference_worker() = delete;
@@ -65,14 +86,15 @@ public:
    *
    * @param _Ie
    * @param _taskq
-   * @param _cv
-   * @param _mtx
-   * @param _key
+   * @param _replica index of the queue of the engine in the task queue
+   * @param _batching
    */
   sync_inference_worker(IEPtr& _Ie,
-                        object_detection_mq<single_bell>::ptr& _taskq)
-      : Ie(_Ie), taskq(_taskq) {
-    ie_log->info("Init inference worker!");
+                        typename object_detection_mq<Bell>::ptr& _taskq,
+                        int _replica, batching_policy _batching = {1, 0})
+      : Ie(_Ie), taskq(_taskq), replica(_replica), batching(_batching) {
+    ie_log->info("Init inference worker {}, max batch {}, max delay {} us",
+                 replica, batching.max_batch, batching.max_delay_us);
   }
   /**
    * @brief Destroy the inference worker object
@@ -82,93 +104,370 @@ public:
   // sync worker public interface implementation
   void operator()() final {
     pthread_setname_np(pthread_self(), "IE worker");
+    if (batching.max_batch > 1) {
+      return batch_loop();
+    }
     // start listening to the queue
-    try {
-      for (;;) {
-        ie_log->debug("Waiting for new task");
-        auto m = taskq->pop();
-        ie_log->debug("Recieve task, invoke inference engine, remaining in queue {}", taskq->size());
-        *m.predictions = Ie->run_detection(m.data, m.size);
-        ie_log->debug("Done inferencing, predidiction size = {}",
-                      m.predictions->size());
-        // Push to queue and notify the sync_http_worker
-        ie_log->debug("Signaling request thread");
-        m.bell->ring(1);
+    for (;;) {
+      ie_log->debug("Waiting for new task");
+      auto m = taskq->pop(replica);
+      ie_log->debug("Recieve task, invoke inference engine, remaining in queue {}", taskq->size(replica));
+      const auto start = std::chrono::steady_clock::now();
+      // the requester gave up, don't spend the engine on it
+      if (m.deadline <= start) {
+        drop(m);
+        continue;
+      }
+      // engines with several inference requests return as soon as the
+      // request is started and notify the requester on completion, so that
+      // the next task is decoded while this one is running
+      auto bell = m.bell;
+      auto predictions = m.predictions;
+      // the service time of the task feeds the scheduler of the queue
+      auto queue = taskq.get();
+      const int index = replica;
+      const int size = m.size;
+      try {
+        Ie->run_detection_async(m.data, m.size, m.params, predictions,
+                                [bell, predictions, queue, index, size,
+                                 start]() {
+          queue->done(index, size, std::chrono::steady_clock::now() - start);
+          ie_log->debug("Done inferencing, predidiction size = {}",
+                        predictions->size());
+          // Notify the requester
+          ie_log->debug("Signaling request thread");
+          bell->ring(1);
+        });
+      } catch (const std::exception& e) {
+        // done is never called once the engine threw, answer the task here
+        std::cerr << e.what() << '\n';
+        fail(m);
       }
-    } catch (const std::exception& e) {
-      std::cerr << e.what() << '\n';
     }
   }
 
 private:
   IEPtr Ie;  //!< pointer to inference engine
-  object_detection_mq<single_bell>::ptr
+  typename object_detection_mq<Bell>::ptr
       taskq;  //!< task queue, will get job in this queue
+  int replica;  //!< index of the queue of the engine
+  batching_policy batching;  //!< dynamic batching policy
+  /**
+   * @brief Answer a task whose deadline has passed without running it
+   *
+   * @param m
+   */
+  void drop(obj_detection_msg<Bell>& m) {
+    ie_log->debug("Drop expired task, {} so far", taskq->expired() + 1);
+    taskq->drop(replica);
+    m.predictions->expired = true;
+    m.bell->ring(1);
+  }
+  /**
+   * @brief Answer a task the engine failed to run
+   *
+   * @param m
+   */
+  void fail(obj_detection_msg<Bell>& m) {
+    taskq->fail(replica);
+    m.predictions->clear();
+    m.predictions->failed = true;
+    m.bell->ring(1);
+  }
+  /**
+   * @brief Serving loop with dynamic batching
+   *
+   */
+  void batch_loop() {
+    std::vector<obj_detection_msg<Bell>> batch;
+    std::vector<const char*> data;
+    std::vector<int> size;
+    std::vector<inference_params> params;
+    std::vector<detection_result*> results;
+    batch.reserve(batching.max_batch);
+    data.reserve(batching.max_batch);
+    size.reserve(batching.max_batch);
+    params.reserve(batching.max_batch);
+    results.reserve(batching.max_batch);
+    for (;;) {
+      ie_log->debug("Waiting for new batch");
+      batch.clear();
+      data.clear();
+      size.clear();
+      params.clear();
+      results.clear();
+      taskq->pop_batch(replica, batch, batching.max_batch,
+                       std::chrono::microseconds(batching.max_delay_us));
+      // the tasks whose requester gave up are dropped before decode
+      const auto now = std::chrono::steady_clock::now();
+      size_t kept = 0;
+      for (size_t i = 0; i < batch.size(); ++i) {
+        if (batch[i].deadline <= now) {
+          drop(batch[i]);
+        } else {
+          if (kept != i) batch[kept] = std::move(batch[i]);
+          ++kept;
+        }
+      }
+      batch.resize(kept);
+      if (batch.empty()) continue;
+      ie_log->debug("Recieve {} tasks, invoke inference engine, remaining in queue {}",
+                    batch.size(), taskq->size(replica));
+      for (auto& m : batch) {
+        data.push_back(m.data);
+        size.push_back(m.size);
+        params.push_back(m.params);
+        results.push_back(m.predictions);
+      }
+      const auto start = std::chrono::steady_clock::now();
+      try {
+        Ie->run_detection_batch(data, size, params, results);
+      } catch (const std::exception& e) {
+        // none of the tasks has been answered yet, answer them all and keep
+        // serving
+        std::cerr << e.what() << '\n';
+        for (auto& m : batch) fail(m);
+        continue;
+      }
+      // the images of a batch share its service time
+      const auto each =
+          (std::chrono::steady_clock::now() - start) / batch.size();
+      for (auto& m : batch) {
+        taskq->done(replica, m.size, each);
+        m.bell->ring(1);
+      }
+    }
+  }
 };
 
 /**
- * @brief http worker that will handler the request
- * @details
- * In sync mode, each time when server receive request,
- * it will create a newthread that run http worker class
+ * @brief Options of the http sessions
  *
  */
-class sync_http_worker : public sync_worker {
-public:
-  sync_http_worker() = delete;
+struct http_options {
+  std::uint64_t body_limit = 64 * 1024 * 1024;  //!< maximum size of body
+  bool legacy_json = false;  //!< numbers of the responses written as strings
+  int max_batch_images = 256;  //!< maximum number of images of POST /batch
+  //! status of the requests turned away by the admission control
+  http::status overload_status = http::status::service_unavailable;
+};
 
+// convert the configured overload status to an http status
+inline http::status int2overload_status(int status) {
+  if (status == 429) {
+    return http::status::too_many_requests;
+  } else if (status == 503) {
+    return http::status::service_unavailable;
+  } else {
+    throw std::logic_error("Overload status [" + std::to_string(status) +
+                           "] has not yet implemented");
+  }
+}
+
+/**
+ * @brief http session that handle one client connection
+ * @details
+ * Sessions are driven by the io_context of the listener, i.e. there is no
+ * thread per connection. A session read a request, handle it, write the
+ * response, then read the next request if the connection is keep-alive.
+ * Inference requests are pushed to the task queue, the I/O thread goes back
+ * to the event loop and the inference worker rings the bell to resume the
+ * session on its strand when the prediction is ready.
+ */
+class http_session : public std::enable_shared_from_this<http_session> {
+public:
+  http_session() = delete;
   /**
-   * @brief Construct a new http worker object
+   * @brief Construct a new http session object
    *
-   * @param _acceptor
-   * @param _sock
-   * @param _data
-   * @param _taskq
+   * @param _sock the accepted socket, the session owns it
+   * @param _taskq task queue
+   * @param _options
    */
-  sync_http_worker(tcp::acceptor& _acceptor, tcp::socket&& _sock, void* _data,
-                   object_detection_mq<single_bell>::ptr& _taskq)
-      : acceptor(_acceptor),
-        sock(std::move(_sock)),
-        data(_data),
-        taskq(_taskq) {
-    bell = std::make_shared<single_bell>();
-    http_log->info("Init new http worker!");
-  }
+  http_session(tcp::socket&& _sock,
+               object_detection_mq<latch_bell>::ptr& _taskq,
+               const http_options& _options)
+      : stream(std::move(_sock)),
+        taskq(_taskq),
+        options(_options) {}
   /**
-   * @brief
+   * @brief Start the session
    *
-   * @return * Default
    */
-  ~sync_http_worker() {}
-  // sync worker public interface implementation
-  void operator()() final {
-    pthread_setname_np(pthread_self(), "http worker");
-    session_handler();
+  void run() {
+    // we need to be executing within the strand to perform async operations
+    // on the I/O objects in this session
+    net::dispatch(stream.get_executor(),
+                  beast::bind_front_handler(&http_session::do_read,
+                                            shared_from_this()));
   }
 
 private:
   // private attribute
-  tcp::acceptor& acceptor;  //!< the acceptor, needed to init our socket
-  tcp::socket sock{
-      acceptor
-          .get_executor()};  //!< the endpoint socket, passed from main thread
-  void* data;                //!< pointer to data, i.e dashboard
-  object_detection_mq<single_bell>::ptr taskq;  //!< task queue
-  single_bell::ptr bell;                        //!< notify bell
+  beast::tcp_stream stream;  //!< the endpoint socket with timeout
+  beast::flat_buffer buffer;  //!< read buffer, must persist between reads
+  std::unique_ptr<http::request_parser<http::string_body>> parser;
+  beast_basic_request req;   //!< current request
+  std::shared_ptr<void> res;  //!< keep the response alive while writing
+  detection_result prediction;  //!< where inference engine write the result,
+                                //!< reused by the requests of the session
+  object_detection_mq<latch_bell>::ptr taskq;  //!< task queue
+  latch_bell bell;  //!< notify bell, reused by the requests of the session
+  //!< keeps the session alive while a request is in the engine
+  std::shared_ptr<http_session> in_flight;
+  http_options options;  //!< options of the listener
+  std::string response_body;  //!< body of the inference responses, reused
+  bool packed_response = false;  //!< the client accepts the binary encoding
+  label_table::ptr sent_labels;  //!< label table already sent in binary
+  // POST /batch, reused by the requests of the session
+  std::vector<batch_part> batch_parts;  //!< images, point into the body
+  std::vector<detection_result> batch_predictions;
+  std::vector<obj_detection_msg<latch_bell>> batch_tasks;
+  std::chrono::seconds timeout{30};  //!< idle timeout of the connection
+  static constexpr size_t device_prefix_size = 10;  //!< "inference/"
   // private method
+  /**
+   * @brief Read the next request
+   *
+   */
+  void do_read() {
+    // construct a new parser for each message
+    parser.reset(new http::request_parser<http::string_body>());
+    parser->body_limit(options.body_limit);
+    stream.expires_after(timeout);
+    http::async_read_header(
+        stream, buffer, *parser,
+        beast::bind_front_handler(&http_session::on_read_header,
+                                  shared_from_this()));
+  }
+  /**
+   * @brief Header read completion handler
+   * @details A client that sends Expect: 100-continue waits for our answer
+   * before it uploads the body, so an overloaded server turns the request
+   * away without reading the image
+   * @param ec
+   * @param bytes_transferred
+   */
+  void on_read_header(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec == http::error::end_of_stream) {
+      return do_close();
+    }
+    if (ec) {
+      return fail(ec, "read");
+    }
+    const auto& header = parser->get();
+    if (!beast::iequals(header[http::field::expect], "100-continue")) {
+      return do_read_body();
+    }
+    std::chrono::nanoseconds retry_after;
+    if (header.method() == http::verb::post &&
+        taskq->overloaded(1, retry_after)) {
+      // the body is not read, the connection can't be reused
+      return send(overload_message(header.version(), false, retry_after));
+    }
+    auto sp = std::make_shared<http::response<http::empty_body>>(
+        http::status::continue_, header.version());
+    res = sp;
+    http::async_write(stream, *sp,
+                      beast::bind_front_handler(&http_session::on_continue,
+                                                shared_from_this()));
+  }
+  /**
+   * @brief 100 Continue write completion handler, read the body
+   *
+   * @param ec
+   * @param bytes_transferred
+   */
+  void on_continue(beast::error_code ec, std::size_t bytes_transferred) {
+    if (ec) {
+      return fail(ec, "write");
+    }
+    res = nullptr;
+    do_read_body();
+  }
+  /**
+   * @brief Read the body of the request
+   *
+   */
+  void do_read_body() {
+    http::async_read(stream, buffer, *parser,
+                     beast::bind_front_handler(&http_session::on_read,
+                                               shared_from_this()));
+  }
+  /**
+   * @brief Read completion handler
+   *
+   * @param ec
+   * @param bytes_transferred
+   */
+  void on_read(beast::error_code ec, std::size_t bytes_transferred) {
+    // client closed the connection
+    if (ec == http::error::end_of_stream) {
+      return do_close();
+    }
+    if (ec) {
+      return fail(ec, "read");
+    }
+    req = parser->release();
+    request_handler();
+  }
+  /**
+   * @brief Send a response
+   * @details The response is moved to the heap and kept alive in the session
+   * until the write complete
+   * @tparam isRequest
+   * @tparam Body
+   * @tparam Fields
+   * @param msg
+   */
+  template <bool isRequest, class Body, class Fields>
+  void send(http::message<isRequest, Body, Fields>&& msg) {
+    auto sp = std::make_shared<http::message<isRequest, Body, Fields>>(
+        std::move(msg));
+    res = sp;
+    stream.expires_after(timeout);
+    http::async_write(stream, *sp,
+                      beast::bind_front_handler(&http_session::on_write,
+                                                shared_from_this(),
+                                                sp->need_eof()));
+  }
+  /**
+   * @brief Write completion handler
+   *
+   * @param close
+   * @param ec
+   * @param bytes_transferred
+   */
+  void on_write(bool close, beast::error_code ec,
+                std::size_t bytes_transferred) {
+    if (ec) {
+      return fail(ec, "write");
+    }
+    if (close) {
+      // the response indicated "Connection: close" semantic
+      return do_close();
+    }
+    res = nullptr;
+    do_read();
+  }
+  /**
+   * @brief Gracefully close the connection
+   *
+   */
+  void do_close() {
+    http_log->info("Shutdown my socket!");
+    beast::error_code ec;
+    stream.socket().shutdown(tcp::socket::shutdown_send, ec);
+  }
   /**
   * @brief This funtion generate error response
   * @details Depend on the type of error status, different responses messages
   * are generated
-  * @tparam Body
-  * @tparam Alocator
-  * @param req
   * @param status
   * @param why
   * @return http::response<http::string_body>
   */
-  http::response<http::string_body> error_message(beast_basic_request& req,
-                                                  http::status status,
+  http::response<http::string_body> error_message(http::status status,
                                                   beast::string_view why) {
     beast_basic_response res{status, req.version()};
     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
@@ -178,6 +477,90 @@ private:
     res.prepare_payload();
     return res;
   }  // error_message
+  /**
+   * @brief Generate the response of a request turned away by the admission
+   * control
+   * @param version of the request
+   * @param keep_alive
+   * @param retry_after predicted time before the server can take it, the
+   * Retry-After header is in whole seconds, at least 1
+   * @return http::response<http::string_body>
+   */
+  http::response<http::string_body> overload_message(
+      unsigned version, bool keep_alive, std::chrono::nanoseconds retry_after) {
+    const std::int64_t ns_per_s = 1000000000;
+    const std::int64_t seconds = std::max<std::int64_t>(
+        1, (retry_after.count() + ns_per_s - 1) / ns_per_s);
+    beast_basic_response res{options.overload_status, version};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/html");
+    res.set(http::field::retry_after, std::to_string(seconds));
+    res.keep_alive(keep_alive);
+    res.body() = "Server overloaded";
+    res.prepare_payload();
+    return res;
+  }  // overload_message
+  /**
+   * @brief Generate a json response
+   *
+   * @param body
+   * @return http::response<http::string_body>
+   */
+  http::response<http::string_body> json_message(std::string&& body) {
+    // Cache the size since we need it after the move
+    auto const size = body.size();
+    beast_basic_response res{std::piecewise_construct,
+                             std::make_tuple(std::move(body)),
+                             std::make_tuple(http::status::ok, req.version())};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "application/json");
+    res.content_length(size);
+    res.keep_alive(req.keep_alive());
+    return res;
+  }  // json_message
+  /**
+   * @brief Generate a response with the body in response_body
+   * @details The response points to the buffer instead of copying it, the
+   * buffer is not touched until the response is written since the session
+   * only reads the next request then
+   * @param content_type
+   * @return http::response<http::span_body<char>>
+   */
+  http::response<http::span_body<char>> buffer_message(
+      const char* content_type) {
+    http::response<http::span_body<char>> res{
+        std::piecewise_construct,
+        std::make_tuple(&response_body[0], response_body.size()),
+        std::make_tuple(http::status::ok, req.version())};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, content_type);
+    res.content_length(response_body.size());
+    res.keep_alive(req.keep_alive());
+    return res;
+  }  // buffer_message
+  /**
+   * @brief Check whether the client accepts the binary encoding of the
+   * predictions
+   * @details Media ranges are matched exactly, so that wildcards and missing
+   * Accept headers keep getting JSON. A range with q=0 is refused.
+   * @return true if Accept lists application/x-st-detections
+   */
+  bool accepts_packed() const {
+    std::istringstream ranges(
+        static_cast<std::string>(req[http::field::accept]));
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+      const auto semicolon = range.find(';');
+      std::string type = range.substr(0, semicolon);
+      type.erase(0, type.find_first_not_of(" \t"));
+      type.erase(type.find_last_not_of(" \t") + 1);
+      if (!beast::iequals(type, packed::content_type)) continue;
+      if (semicolon == std::string::npos) return true;
+      const auto q = range.find("q=", semicolon);
+      return q == std::string::npos || std::atof(range.c_str() + q + 2) > 0;
+    }
+    return false;
+  }
   /**
  * @brief This function resolve the request target to route it to proper
  * resource.
@@ -193,21 +576,27 @@ private:
     // Assume the request to the server is always in form `/{resource}`
     // current supported resources
     static const std::set<std::string> resources = {"/",
-                                                    "v1"
+                                                    "v1",
                                                     "metadata",
-                                                    "inference"};
+                                                    "inference",
+                                                    "batch",
+                                                    "metrics"};
     if (target.empty() || target[0] != '/' ||
         target.find("..") != beast::string_view::npos)
       return "";
+    // the query string is read by the handler of the resource
+    beast::string_view path = target.substr(0, target.find('?'));
     std::string ret;
-    if (target.size() == 1) {  // send header
+    if (path.size() == 1) {  // send header
       ret = "/";
     } else {
       // string_view has no null-terminated, therefore it cannot implicitly
       // convert from string_view to string
-      ret = static_cast<std::string>(target.substr(1, target.size()));
+      ret = static_cast<std::string>(path.substr(1, path.size()));
     }
-    if (resources.find(ret) == resources.end()) {
+    // inference/{device}: explicit routing to the engines of a device
+    if (resources.find(ret) == resources.end() &&
+        ret.compare(0, device_prefix_size, "inference/") != 0) {
       // raise no_such_file error
       ec = beast::errc::make_error_code(beast::errc::no_such_file_or_directory);
     }
@@ -226,6 +615,7 @@ private:
     JSON what_next;
     what_next.put<std::string>("API", "GET /v1/ for supported API");
     what_next.put<std::string>("INFO", "GET /metadata/ for model information");
+    what_next.put<std::string>("METRICS", "GET /metrics for server counters");
     res.put_child("what next", what_next);
     std::ostringstream ss;
     bpt::write_json(ss, res);
@@ -246,97 +636,437 @@ private:
        << "}\n";
     return ss.str();
   }  // metadata_request_handler
+  /**
+   * @brief Counters of the server, at GET /metrics
+   * @details queued: tasks waiting in the queues, expired: tasks dropped
+   * since the start because their deadline had passed
+   */
+  std::string metrics_request_handler() {
+    std::ostringstream ss;
+    ss << "{\n"
+       << "\"queued\": " << taskq->size() << ",\n"
+       << "\"expired\": " << taskq->expired() << "\n"
+       << "}\n";
+    return ss.str();
+  }  // metrics_request_handler
+  /**
+   * @brief Read the deadline of a request from the X-Request-Timeout header
+   * @details The timeout is in milliseconds from the arrival of the request,
+   * e.g. X-Request-Timeout: 500. A request without the header, or with a
+   * timeout of a day or more, has no deadline.
+   * @param deadline
+   * @return false if the timeout is not a non-negative integer
+   */
+  bool parse_deadline(std::chrono::steady_clock::time_point& deadline) {
+    static constexpr long long max_timeout_ms = 24LL * 3600 * 1000;
+    deadline = std::chrono::steady_clock::time_point::max();
+    const std::string field =
+        static_cast<std::string>(req["X-Request-Timeout"]);
+    if (field.empty()) return true;
+    try {
+      size_t pos = 0;
+      const long long ms = std::stoll(field, &pos);
+      if (pos != field.size() || ms < 0) return false;
+      if (ms < max_timeout_ms) {
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::milliseconds(ms);
+      }
+      return true;
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  /**
+   * @brief Read the options of an inference request from the query string
+   * @details The keys are top_k and min_confidence, e.g.
+   * POST /inference?top_k=5&min_confidence=0.2, other keys are ignored
+   * @param params
+   * @return false if a value is not a number
+   */
+  bool parse_inference_params(inference_params& params) {
+    beast::string_view target = req.target();
+    const auto q = target.find('?');
+    if (q == beast::string_view::npos) return true;
+    std::istringstream query(static_cast<std::string>(target.substr(q + 1)));
+    std::string item;
+    while (std::getline(query, item, '&')) {
+      const auto eq = item.find('=');
+      const std::string key = item.substr(0, eq);
+      const std::string value =
+          eq == std::string::npos ? "" : item.substr(eq + 1);
+      try {
+        size_t pos = 0;
+        if (key == "top_k") {
+          params.top_k = std::stoi(value, &pos);
+        } else if (key == "min_confidence") {
+          params.min_confidence = std::stof(value, &pos);
+        } else {
+          continue;
+        }
+        if (pos != value.size()) return false;
+      } catch (const std::exception&) {
+        return false;
+      }
+    }
+    return true;
+  }
+  /**
+   * @brief Read the format of a raw frame from the headers of an image
+   * @details Raw frames are sent as Content-Type: image/x-raw-bgr,
+   * image/x-raw-rgb or image/x-raw-nv12 with the headers X-Image-Width,
+   * X-Image-Height and optionally X-Image-Stride (bytes per row). Other image
+   * types are left to the decoder.
+   * @tparam Headers callable that returns the value of a header, empty if
+   * the header is missing
+   * @param content_type
+   * @param headers headers of the request, or of the part of a batch
+   * @param size size of the image
+   * @param format
+   * @return false if the frame is raw and its headers are missing, invalid or
+   * don't match the size of the image
+   */
+  template <class Headers>
+  static bool parse_image_format(beast::string_view content_type,
+                                 const Headers& headers, size_t size,
+                                 image_format& format) {
+    static const beast::string_view raw_prefix = "image/x-raw-";
+    if (content_type.substr(0, raw_prefix.size()) != raw_prefix) return true;
+    auto subtype = content_type.substr(raw_prefix.size());
+    subtype = subtype.substr(0, subtype.find(';'));
+    if (!parse_pixel_format(static_cast<std::string>(subtype),
+                            &format.format)) {
+      return false;
+    }
+    auto header_int = [&headers](const char* name, int& value) -> bool {
+      const std::string field = static_cast<std::string>(headers(name));
+      if (field.empty()) return false;
+      try {
+        size_t pos = 0;
+        value = std::stoi(field, &pos);
+        return pos == field.size();
+      } catch (const std::exception&) {
+        return false;
+      }
+    };
+    if (!header_int("X-Image-Width", format.width) ||
+        !header_int("X-Image-Height", format.height)) {
+      return false;
+    }
+    if (!headers("X-Image-Stride").empty() &&
+        !header_int("X-Image-Stride", format.stride)) {
+      return false;
+    }
+    return format.valid(size);
+  }
+  /**
+   * @brief Header lookup of the request for parse_image_format
+   *
+   */
+  struct request_headers {
+    const beast_basic_request& req;
+    beast::string_view operator()(const char* name) const { return req[name]; }
+  };
+  struct part_headers {
+    const batch_part& part;
+    beast::string_view operator()(const char* name) const {
+      return part.header(name);
+    }
+  };
   /**
   * @brief This funtion handles the inference request at POST /inference
-  * ?All request return string body, so its return type is std::string should
-  * we format it with JSON?
+  * @details The task is pushed to the queue and the function returns
+  * immediately, the response is sent in on_inference_done when the
+  * inference engine rings the bell
+  * @param targets the engines that may run the request, 0 to let the
+  * scheduler pick one
   */
-  std::string inference_request_handler(beast_basic_request& req) {
+  void inference_request_handler(std::uint64_t targets = 0) {
     // we know this is the post method
     // now, first extact the content-type
-
-    // boost::beast::http::header<true,
-    // boost::beast::http::basic_fields<std::allocator<char> > >&
     auto& header = req.base();
     // string body --> basic_string
     auto& body = req.body();
     beast::string_view const& content_type = header["content-type"];
     if (content_type.find("image/") == std::string::npos) {
-      return "{\n\"message\":\"not an image\"\n}";
+      return send(json_message("{\n\"message\":\"not an image\"\n}"));
+    }
+    inference_params params;
+    if (!parse_inference_params(params)) {
+      return send(error_message(http::status::bad_request,
+                                "Illegal query string"));
+    }
+    if (!parse_image_format(content_type, request_headers{req},
+                            req.body().size(), params.input)) {
+      return send(error_message(http::status::bad_request,
+                                "Illegal raw image format"));
+    }
+    std::chrono::steady_clock::time_point deadline;
+    if (!parse_deadline(deadline)) {
+      return send(error_message(http::status::bad_request,
+                                "Illegal X-Request-Timeout"));
+    }
+    std::chrono::nanoseconds retry_after;
+    if (taskq->overloaded(1, retry_after)) {
+      return send(overload_message(req.version(), req.keep_alive(),
+                                   retry_after));
     }
 
+    packed_response = accepts_packed();
     auto data = body.data();
     int size = body.size();
-    std::vector<bbox> prediction;
+    prediction.clear();
+    in_flight = shared_from_this();
+    bell.on_ring<http_session, &http_session::on_inference_rung>(this);
+    // the request may stay in queue for a while, don't let the timer close
+    // the connection under our feet
+    stream.expires_never();
     // exception handling in run, no need to santiny check
     // push to queue
-    obj_detection_msg<single_bell> m{data, size, &prediction, bell};
+    obj_detection_msg<latch_bell> m{data, size, &prediction, &bell};
+    m.params = params;
+    m.deadline = deadline;
     http_log->debug("Enqueue my task, current queue size {}",
                   taskq->size());
-    taskq->push(m);
-    http_log->debug("Waiting for inference engine");
-    bell->wait(1);
-    http_log->debug("Recieved data");
-    int n = prediction.size();
-    // create property tree and write to json
-    JSON res;     // our response
-    JSON bboxes;  // predicion
-    for (int i = 0; i < n; ++i) {
-      // parse prediction[i] to p[i]
-      bbox& pred = prediction[i];
-      JSON p;
-      p.put<int>("label_id", pred.label_id);
-      p.put<std::string>("label", pred.label);
-      p.put<float>("confidences", pred.prop);
-      JSON tmp;
-      if (pred.c[3]) { // ymax should never be zero
-        for (int i = 0; i < 4; ++i) {
-          JSON v;
-          v.put<int>("", pred.c[i]);
-          tmp.push_back({"", v});
-        }
-        p.put_child("detection_box", std::move(tmp));
-      }
-      bboxes.push_back({"", std::move(p)});
+    // the I/O threads never wait for the engines, a request that doesn't fit
+    // in the queues is turned away like an overloaded one
+    const bool queued = targets != 0
+                            ? taskq->try_push_to(std::move(m), targets)
+                            : taskq->try_push(std::move(m));
+    if (!queued) {
+      prediction.rejected = true;
+      bell.ring();
     }
-    res.put_child("predictions", std::move(bboxes));
-    std::ostringstream ss;
-    bpt::write_json(ss, res);
-    return ss.str();
   }  // inferennce_request_handler
+  /**
+   * @brief Split the body of a batch request into images
+   * @details multipart/mixed bodies carry the content type and the raw frame
+   * headers of each image in its part. In application/x-st-batch bodies,
+   * the images share the X-Image-Type header (the content type, encoded
+   * images by default) and the raw frame headers of the request.
+   * @param shared options of the request
+   * @param params where the options of each image are written
+   * @return http::status::ok, or the error status of the request
+   */
+  http::status split_batch(const inference_params& shared,
+                           std::vector<inference_params>& params) {
+    const auto& body = req.body();
+    const beast::string_view content_type = req[http::field::content_type];
+    const size_t max_parts = options.max_batch_images;
+    batch_parts.clear();
+    split_status split = split_status::MALFORMED;
+    if (beast::iequals(content_type.substr(0, content_type.find(';')),
+                       length_prefixed_batch)) {
+      split = split_length_prefixed(body, max_parts, batch_parts);
+    } else if (content_type.substr(0, 10) == "multipart/") {
+      split = split_multipart(body, multipart_boundary(content_type),
+                              max_parts, batch_parts);
+    } else {
+      return http::status::unsupported_media_type;
+    }
+    if (split == split_status::TOO_LARGE) {
+      return http::status::payload_too_large;
+    }
+    if (split != split_status::OK) return http::status::bad_request;
+    const beast::string_view shared_type = req["X-Image-Type"];
+    params.assign(batch_parts.size(), shared);
+    for (size_t i = 0; i < batch_parts.size(); ++i) {
+      const batch_part& part = batch_parts[i];
+      image_format& format = params[i].input;
+      const bool valid =
+          part.headers.empty()
+              ? parse_image_format(shared_type, request_headers{req},
+                                   part.size, format)
+              : parse_image_format(part.header("Content-Type"),
+                                   part_headers{part}, part.size, format);
+      if (!valid) return http::status::bad_request;
+    }
+    return http::status::ok;
+  }
+  /**
+   * @brief This function handles the batch request at POST /batch
+   * @details All the images are pushed to the queue at once with a shared
+   * bell, the response is sent in on_batch_done when the last one is done.
+   * The query string applies to all the images.
+   */
+  void batch_request_handler() {
+    inference_params shared;
+    if (!parse_inference_params(shared)) {
+      return send(error_message(http::status::bad_request,
+                                "Illegal query string"));
+    }
+    std::chrono::steady_clock::time_point deadline;
+    if (!parse_deadline(deadline)) {
+      return send(error_message(http::status::bad_request,
+                                "Illegal X-Request-Timeout"));
+    }
+    std::vector<inference_params> params;
+    const http::status status = split_batch(shared, params);
+    if (status != http::status::ok) {
+      return send(error_message(status, "Illegal batch body"));
+    }
+    const size_t n = batch_parts.size();
+    if (taskq->too_large(static_cast<int>(n))) {
+      return send(error_message(http::status::payload_too_large,
+                                "More images than the server queues"));
+    }
+    std::chrono::nanoseconds retry_after;
+    if (n != 0 && taskq->overloaded(static_cast<int>(n), retry_after)) {
+      return send(overload_message(req.version(), req.keep_alive(),
+                                   retry_after));
+    }
+    packed_response = accepts_packed();
+    if (batch_predictions.size() < n) batch_predictions.resize(n);
+    if (n == 0) return on_batch_done();
+    batch_tasks.clear();
+    for (size_t i = 0; i < n; ++i) {
+      batch_predictions[i].clear();
+      const char* data = batch_parts[i].data;
+      int size = batch_parts[i].size;
+      obj_detection_msg<latch_bell> m{data, size, &batch_predictions[i],
+                                      &bell};
+      m.params = params[i];
+      m.deadline = deadline;
+      batch_tasks.push_back(m);
+    }
+    in_flight = shared_from_this();
+    bell.on_ring<http_session, &http_session::on_batch_rung>(
+        this, static_cast<int>(n));
+    stream.expires_never();
+    http_log->debug("Enqueue {} tasks, current queue size {}", n,
+                    taskq->size());
+    // the images that don't fit in the queues ring the bell themselves, the
+    // batch is answered once the queued ones are done
+    const auto queued = taskq->try_push(batch_tasks.begin(), batch_tasks.end());
+    for (auto it = queued; it != batch_tasks.end(); ++it) {
+      it->predictions->rejected = true;
+    }
+    // flagged before the first ring, the last ring may answer right away
+    for (auto it = queued; it != batch_tasks.end(); ++it) bell.ring();
+  }  // batch_request_handler
+  /**
+   * @brief Write the predictions of a batch to the client, in the order of
+   * the images
+   * @details JSON: {"results": [{"predictions": [...]}, ...]}. Binary: for
+   * each image, its size as a little-endian u32 then the binary response of
+   * the image, the label table is only in the first one.
+   */
+  void on_batch_done() {
+    http_log->debug("Recieved batch");
+    const size_t n = batch_parts.size();
+    for (size_t i = 0; i < n; ++i) {
+      if (batch_predictions[i].rejected) {
+        return send(overload_message(req.version(), req.keep_alive(),
+                                     taskq->predicted_delay()));
+      }
+    }
+    // the images share the deadline, any of them dropped fails the batch
+    for (size_t i = 0; i < n; ++i) {
+      if (batch_predictions[i].expired) {
+        return send(error_message(http::status::gateway_timeout,
+                                  "Deadline exceeded"));
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (batch_predictions[i].failed) {
+        return send(error_message(http::status::internal_server_error,
+                                  "Inference failed"));
+      }
+    }
+    response_body.clear();
+    if (packed_response) {
+      for (size_t i = 0; i < n; ++i) {
+        const detection_result& prediction = batch_predictions[i];
+        const bool with_labels = prediction.labels != sent_labels;
+        const size_t pos = response_body.size();
+        response_body.append(4, '\0');
+        write_packed(prediction, with_labels, response_body);
+        packed::put_u32(
+            static_cast<std::uint32_t>(response_body.size() - pos - 4),
+            &response_body[pos]);
+        if (with_labels) sent_labels = prediction.labels;
+      }
+      return send(buffer_message(packed::content_type));
+    }
+    st::json::writer w(response_body, options.legacy_json);
+    w.begin_object().key("results").begin_array();
+    for (size_t i = 0; i < n; ++i) {
+      write_json(batch_predictions[i], options.legacy_json, w);
+    }
+    w.end_array().end_object();
+    response_body.push_back('\n');
+    send(buffer_message("application/json"));
+  }  // on_batch_done
+  /**
+   * @brief Rung by the inference worker in its own thread, move back to our
+   * strand before touching the session
+   *
+   */
+  void on_inference_rung() {
+    net::post(stream.get_executor(),
+              beast::bind_front_handler(&http_session::on_inference_done,
+                                        std::move(in_flight)));
+  }
+  void on_batch_rung() {
+    net::post(stream.get_executor(),
+              beast::bind_front_handler(&http_session::on_batch_done,
+                                        std::move(in_flight)));
+  }
+  /**
+   * @brief Write the prediction to the client
+   *
+   */
+  void on_inference_done() {
+    http_log->debug("Recieved data");
+    if (prediction.rejected) {
+      return send(overload_message(req.version(), req.keep_alive(),
+                                   taskq->predicted_delay()));
+    }
+    if (prediction.expired) {
+      return send(error_message(http::status::gateway_timeout,
+                                "Deadline exceeded"));
+    }
+    if (prediction.failed) {
+      return send(error_message(http::status::internal_server_error,
+                                "Inference failed"));
+    }
+    response_body.clear();
+    if (packed_response) {
+      // the label table is sent once per connection, with the first response
+      // and again only if the engine changes it
+      const bool with_labels = prediction.labels != sent_labels;
+      write_packed(prediction, with_labels, response_body);
+      if (with_labels) sent_labels = prediction.labels;
+      return send(buffer_message(packed::content_type));
+    }
+    write_json(prediction, options.legacy_json, response_body);
+    send(buffer_message("application/json"));
+  }  // on_inference_done
   /**
   * @brief this is our handler
   *
-  * @param req
-  * @param sender
-  * @return * Request
   */
-  template <class Send>
-  void request_handler(beast_basic_request&& req, Send& sender) {
+  void request_handler() {
     // Make sure we can handle the method
     if (req.method() != http::verb::get && req.method() != http::verb::head &&
         req.method() != http::verb::post)
-      return sender(
-          error_message(req, http::status::bad_request, "Unknown HTTP-method"));
+      return send(error_message(http::status::bad_request,
+                                "Unknown HTTP-method"));
 
     // Request path must be absolute and not contain "..".
     beast::error_code ec;
     std::string target = request_resolve(req.target(), ec);
     if (target.size() == 0) {
-      return sender(error_message(req, http::status::bad_request,
-                                  "Illegal request-target"));
+      return send(error_message(http::status::bad_request,
+                                "Illegal request-target"));
     }
 
     // Handle the case where the resource doesn't exist
     if (ec == beast::errc::no_such_file_or_directory)
-      return sender(error_message(req, http::status::not_found, "Not found"));
-
-    // Creating our response with string_body
-    http::string_body::value_type body;
+      return send(error_message(http::status::not_found, "Not found"));
 
     // Handle an unknown error
     if (ec)
-      return sender(error_message(req, http::status::unknown, ec.message()));
+      return send(error_message(http::status::unknown, ec.message()));
 
     // Respond to HEAD request, alway just send the basic information of the
     // server
@@ -346,127 +1076,160 @@ private:
       res.set(http::field::content_type, mime_type(target));
       res.content_length(0);
       res.keep_alive(req.keep_alive());
-      return sender(std::move(res));
+      return send(std::move(res));
     } else if (req.method() == http::verb::get) {
       // Respond to GET request
       if (target == "/") {
-        body = greeting();
+        return send(json_message(greeting()));
       } else if (target == "metadata") {
-        body = metadata_request_handler();
+        return send(json_message(metadata_request_handler()));
+      } else if (target == "metrics") {
+        return send(json_message(metrics_request_handler()));
       } else {
-        return sender(error_message(req, http::status::bad_request,
-                                    "Illegal HTTP method"));
+        return send(error_message(http::status::bad_request,
+                                  "Illegal HTTP method"));
       }
-      // Cache the size since we need it after the move
-      auto const size = body.size();
-      beast_basic_response res{
-          std::piecewise_construct, std::make_tuple(std::move(body)),
-          std::make_tuple(http::status::ok, req.version())};
-      res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-      res.set(http::field::content_type, "application/json");
-      res.content_length(size);
-      res.keep_alive(req.keep_alive());
-      return sender(std::move(res));
     } else {
       // Respond to POST request
       if (target == "inference") {
-        body = inference_request_handler(req);
+        return inference_request_handler();
+      } else if (target.compare(0, device_prefix_size, "inference/") == 0) {
+        const std::uint64_t targets =
+            taskq->device_mask(target.substr(device_prefix_size));
+        if (targets == 0) {
+          return send(error_message(http::status::not_found,
+                                    "No inference engine on this device"));
+        }
+        return inference_request_handler(targets);
+      } else if (target == "batch") {
+        return batch_request_handler();
       } else {
-        return sender(error_message(req, http::status::bad_request,
-                                    "Illegal HTTP method"));
+        return send(error_message(http::status::bad_request,
+                                  "Illegal HTTP method"));
       }
-      // Cache the size since we need it after the move
-      auto const size = body.size();
-      beast_basic_response res{
-          std::piecewise_construct, std::make_tuple(std::move(body)),
-          std::make_tuple(http::status::ok, req.version())};
-      res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-      res.set(http::field::content_type, "application/json");
-      res.content_length(size);
-      res.keep_alive(req.keep_alive());
-      sender(std::move(res));
     }
   }  // request_handler
-  /**
-  * @brief handler the session
-  *
-  * @return * Session
-  */
-  void session_handler() {
-    bool close = false;
-    beast::error_code ec;
+};   // class http_session
 
-    // send-receive buffer
-    beast::flat_buffer buffer;
+/**
+ * @brief Listener that accept incoming connection and launch the sessions
+ *
+ */
+class http_listener : public std::enable_shared_from_this<http_listener> {
+public:
+  http_listener(net::io_context& _ioc, tcp::endpoint endpoint,
+                object_detection_mq<latch_bell>::ptr& _taskq,
+                const http_options& _options)
+      : ioc(_ioc),
+        acceptor(net::make_strand(_ioc)),
+        retry_timer(acceptor.get_executor()),
+        taskq(_taskq),
+        options(_options) {
+    beast::error_code ec;
+    // open the acceptor
+    acceptor.open(endpoint.protocol(), ec);
+    if (ec) {
+      fail(ec, "open");
+      return;
+    }
+    // allow address reuse
+    acceptor.set_option(net::socket_base::reuse_address(true), ec);
+    if (ec) {
+      fail(ec, "set option");
+      return;
+    }
+    // bind to the server address
+    acceptor.bind(endpoint, ec);
+    if (ec) {
+      fail(ec, "bind");
+      return;
+    }
+    // start listening for connection
+    acceptor.listen(net::socket_base::max_listen_connections, ec);
+    if (ec) {
+      fail(ec, "listen");
+      return;
+    }
+  }
+  /**
+   * @brief Start accepting incomming connection
+   *
+   */
+  void run() { do_accept(); }
 
-    // init sender, associate it with an error code that we can read later
-    send_lambda<tcp::socket> sender{sock, close, ec};
-    std::chrono::time_point<std::chrono::system_clock> start;
-    std::chrono::time_point<std::chrono::system_clock> end;
+private:
+  net::io_context& ioc;
+  tcp::acceptor acceptor;
+  net::steady_timer retry_timer;  //!< delays the accept after an error
+  std::chrono::milliseconds retry_delay{0};  //!< grows while accept fails
+  object_detection_mq<latch_bell>::ptr taskq;  //!< task queue
+  http_options options;  //!< options of the sessions
 
-    for (;;) {
-      // read from socket
-      start = std::chrono::system_clock::now();  // sync mode only
-      beast_basic_request req;
-      http::read(sock, buffer, req, ec);
-      end = std::chrono::system_clock::now(); 
-      std::chrono::duration<double, std::milli> elapsed_mil0 = end-start;
-      // if read indicates end of stream, stop reading
-      if (ec == http::error::end_of_stream) {
-        break;
-      }
-      // if other read error, stop doing session
-      if (ec) {
-        return fail(ec, "read");
-      }
-      // handle request
-      start = std::chrono::system_clock::now();  // sync mode only
-      request_handler(std::move(req), sender);
-      end = std::chrono::system_clock::now(); 
-      std::chrono::duration<double, std::milli> elapsed_mil1 = end-start;
-      http_log->debug("Read from socket in {} ms, handle request in {} ms",
-                      elapsed_mil0.count(), elapsed_mil1.count());
-      // handler write error report by sender
-      if (ec) {
-        return fail(ec, "write");
-      }
-      if (close) {
-        break;
-      }
+  void do_accept() {
+    // the new connection gets it own strand
+    acceptor.async_accept(
+        net::make_strand(ioc),
+        beast::bind_front_handler(&http_listener::on_accept,
+                                  shared_from_this()));
+  }
+  void on_accept(beast::error_code ec, tcp::socket sock) {
+    if (ec) {
+      fail(ec, "accept");
+      // e.g. out of file descriptors, accepting again right away would spin
+      // until a connection is closed, back off instead
+      const std::chrono::milliseconds min_delay(10), max_delay(1000);
+      retry_delay = std::min(max_delay, std::max(min_delay, retry_delay * 2));
+      retry_timer.expires_after(retry_delay);
+      retry_timer.async_wait(beast::bind_front_handler(
+          &http_listener::on_retry, shared_from_this()));
+      return;
     }
-    // If we can reach here, the the request is successful
-    // Shut down the socket and return
-    http_log->info("Shutdown my socket!");
-    sock.shutdown(tcp::socket::shutdown_send, ec);
-    return;
-  }  // session_handler
-};   // class sync_http_worker
+    retry_delay = std::chrono::milliseconds(0);
+    http_log->info("New client: {}",
+                   sock.remote_endpoint(ec).address().to_string());
+    // create the session and run it
+    std::make_shared<http_session>(std::move(sock), taskq, options)->run();
+    // keep accepting
+    do_accept();
+  }
+  void on_retry(beast::error_code ec) {
+    if (ec) {
+      return fail(ec, "accept timer");
+    }
+    do_accept();
+  }
+};  // class http_listener
 
 /**
  * @brief listening worker that will listen to connection
- *
+ * @details The worker owns the io_context and run it on a fixed number of
+ * I/O threads, all sessions are multiplexed on these threads
  */
-class sync_listen_worker : public sync_worker {
+class http_listen_worker : public sync_worker {
  public:
-  sync_listen_worker() = delete;
+  http_listen_worker() = delete;
   /**
    * @brief Construct a new listen worker object
    *
    * @param _taskq
+   * @param _num_threads number of I/O threads
+   * @param _options options of the sessions
    */
-  sync_listen_worker(object_detection_mq<single_bell>::ptr& _taskq)
-      : taskq(_taskq) {}
+  http_listen_worker(object_detection_mq<latch_bell>::ptr& _taskq,
+                     int _num_threads, const http_options& _options)
+      : taskq(_taskq),
+        num_threads(std::max(1, _num_threads)),
+        options(_options) {}
   /**
    * @brief Destroy the listen worker object
    *
    */
-  ~sync_listen_worker() {}
+  ~http_listen_worker() {}
   // sync worker public interface implementation
   void operator()() final {
     pthread_setname_np(pthread_self(), "listen worker");
-    std::cout << "Warning: no IP and address is provide" << std::endl;
-    std::cout << "Use defaul address 0.0.0.0 and default port 8080"
-              << std::endl;
+    http_log->warn("No IP and address is provide");
+    http_log->warn("Use defaul address 0.0.0.0 and default port 8080");
     listen("0.0.0.0", "8080");
   }
   /**
@@ -481,7 +1244,9 @@ class sync_listen_worker : public sync_worker {
   }
 
 private:
-  object_detection_mq<single_bell>::ptr taskq;  //!< task queue
+  object_detection_mq<latch_bell>::ptr taskq;  //!< task queue
+  int num_threads;                                //!< number of I/O threads
+  http_options options;  //!< options of the sessions
   /**
    * @brief
    *
@@ -492,26 +1257,29 @@ private:
     auto const address = net::ip::make_address(ip);
     auto const port = static_cast<unsigned short>(std::stoi(p));
     // the io_contex is required to all IO - boost asio implementation
-    net::io_context ioc{1};  // we have only 1 listening thread in sync model
-    // the acceptor that will recieve incomming request
-    http_log->info("Start accepting on {}:{}", ip, p);
-    tcp::acceptor acceptor{ioc, {address, port}};
-    for (;;) {
-      // this socket will run
-      tcp::socket sock{ioc};
-      // accep, blocking until new connection
-      acceptor.accept(sock);
-      http_log->info("New client: {}",sock.remote_endpoint().address().to_string());
-      // launch new http worker to handle new request
-      // transfer ownership of socket to the worker
-      auto f = [&](tcp::socket& _sock) {
-        sync_http_worker httper{acceptor, std::move(_sock), nullptr, taskq};
-        httper();
-      };
-      std::thread{std::bind(f, std::move(sock))}.detach();
+    net::io_context ioc{num_threads};
+    // create and launch the listener
+    http_log->info("Start accepting on {}:{} with {} I/O threads", ip, p,
+                   num_threads);
+    std::make_shared<http_listener>(ioc, tcp::endpoint{address, port}, taskq,
+                                    options)
+        ->run();
+    // run the I/O service on the requested number of threads, the last one is
+    // myself
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (int i = 0; i < num_threads - 1; ++i) {
+      threads.emplace_back([&ioc] {
+        pthread_setname_np(pthread_self(), "http I/O");
+        ioc.run();
+      });
+    }
+    ioc.run();
+    for (auto& t : threads) {
+      t.join();
     }
   }
-};  // class listen worker
+};  // class http_listen_worker
 
 /**
  * @brief